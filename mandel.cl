@@ -3,6 +3,59 @@
     #include "mandelutils.c"
 #endif
 
+// settings baked in with -D by specialized builds (see
+// FractalCompute::spec_kernel), so that the compiler can fold the branches on
+// them, else read at run time. MAXITER stays a run time value, under a bound
+// (the power of two above it) that caps the trip counts of the loops
+#ifdef SPEC_MANDEL
+#define P_MANDEL(param) SPEC_MANDEL
+#else
+#define P_MANDEL(param) (param)->mandel
+#endif
+#ifdef SPEC_MAXITER_BOUND
+#define P_MAXITER(param) min((param)->MAXITER, SPEC_MAXITER_BOUND)
+#else
+#define P_MAXITER(param) (param)->MAXITER
+#endif
+#ifdef SPEC_PROXTYPE
+#define P_PROXTYPE(PROXTYPE) SPEC_PROXTYPE
+#else
+#define P_PROXTYPE(PROXTYPE) (PROXTYPE)
+#endif
+
+// pixel handled by this work item, progressive passes only compute every
+// step-th one and leave those already done by the coarser pass
+inline int pixel_of(__global FParam_t *param, int *i, int *j)
+{
+    *i = get_global_id(0)*param->step;
+    *j = get_global_id(1)*param->step;
+
+    if (*i >= param->dims.imH || *j >= param->dims.imW)
+        return 0;
+
+    return !(param->skip && *i%param->skip == 0 && *j%param->skip == 0);
+}
+
+// Early exits are counted per work-group in local memory, then added to
+// early_g by its first item, rather than with an atomic on early_g for every
+// interior pixel. All items of the group have to reach both, so the kernels
+// using them do not return before early_done
+inline void early_begin(__local int *group_early)
+{
+    if (get_local_id(0) == 0 && get_local_id(1) == 0)
+        *group_early = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+inline void early_done(__local int *group_early, __global int *early_g, int early)
+{
+    if (early)
+        atomic_inc(group_early);
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (get_local_id(0) == 0 && get_local_id(1) == 0 && *group_early)
+        atomic_add(early_g, *group_early);
+}
+
 __kernel void apply_log_int(__global int *res_g)
 {
     int i = get_global_id(0);
@@ -24,119 +77,570 @@ __kernel void apply_log_fpn(__global FPN *res_g)
 }
 
 __kernel void escape_iter(__global int *res_g,
-                          __global FParam_t *param)
+                          __global FParam_t *param,
+                          __global int *early_g)
+{
+    __local int group_early;
+    early_begin(&group_early);
+
+    int N = param->dims.imH;
+    int M = param->dims.imW;
+    int i, j, early = 0;
+    if (pixel_of(param, &i, &j)) {
+        Complex_t p = {param->view_rect.left + j*(param->view_rect.right-param->view_rect.left)/M,
+                       param->view_rect.bot  + i*(param->view_rect.top  -param->view_rect.bot )/N};
+
+        Complex_t _c = P_MANDEL(param) ? p : param->c;
+
+        res_g[i*M+j] = _escape_iter(p, _c, P_MAXITER(param), param->interior, &early);
+    }
+    early_done(&group_early, early_g, early);
+}
+
+__kernel void escape_iter_fpn(__global FPN *res_g,
+                              __global FParam_t *param,
+                              __global int *early_g)
+{
+    __local int group_early;
+    early_begin(&group_early);
+
+    int N = param->dims.imH;
+    int M = param->dims.imW;
+    int i, j, early = 0;
+    if (pixel_of(param, &i, &j)) {
+        Complex_t p = {param->view_rect.left + j*(param->view_rect.right-param->view_rect.left)/M,
+                       param->view_rect.bot  + i*(param->view_rect.top  -param->view_rect.bot )/N};
+
+        Complex_t _c = P_MANDEL(param) ? p : param->c;
+
+        res_g[i*M+j] = ((FPN) _escape_iter(p, _c, P_MAXITER(param), param->interior, &early))/((FPN) P_MAXITER(param));
+    }
+    early_done(&group_early, early_g, early);
+}
+
+__kernel void min_prox(__global FPN *res_g,
+                       __global FParam_t *param,
+                       __global int *early_g,
+                       int       PROXTYPE)
+{
+    __local int group_early;
+    early_begin(&group_early);
+
+    int N = param->dims.imH;
+    int M = param->dims.imW;
+    int i, j, early = 0;
+    if (pixel_of(param, &i, &j)) {
+        Complex_t p = {param->view_rect.left + j*(param->view_rect.right-param->view_rect.left)/M,
+                       param->view_rect.bot  + i*(param->view_rect.top  -param->view_rect.bot )/N};
+
+        Complex_t _c = P_MANDEL(param) ? p : param->c;
+
+        res_g[i*M+j] = _minprox(p, _c, P_MAXITER(param), P_PROXTYPE(PROXTYPE), param->interior, &early);
+    }
+    early_done(&group_early, early_g, early);
+}
+
+__kernel void orbit_trap(__global Complex_t *res_g,
+                         __global FParam_t  *param,
+                         __global int       *early_g,
+                         Box_t               trap)
+{
+    __local int group_early;
+    early_begin(&group_early);
+
+    int N = param->dims.imH;
+    int M = param->dims.imW;
+    int i, j, early = 0;
+    if (pixel_of(param, &i, &j)) {
+        Complex_t p = {param->view_rect.left + j*(param->view_rect.right-param->view_rect.left)/M,
+                       param->view_rect.bot  + i*(param->view_rect.top  -param->view_rect.bot )/N};
+
+        Complex_t _c = P_MANDEL(param) ? p : param->c;
+
+        res_g[i*M+j] = _orbit_trap(p, _c, trap, P_MAXITER(param), param->interior, &early);
+    }
+    early_done(&group_early, early_g, early);
+}
+
+__kernel void orbit_trap_re(__global FPN       *res_g,
+                            __global FParam_t  *param,
+                            __global int       *early_g,
+                            Box_t               trap)
+{
+    __local int group_early;
+    early_begin(&group_early);
+
+    int N = param->dims.imH;
+    int M = param->dims.imW;
+    int i, j, early = 0;
+    if (pixel_of(param, &i, &j)) {
+        Complex_t p = {param->view_rect.left + j*(param->view_rect.right-param->view_rect.left)/M,
+                       param->view_rect.bot  + i*(param->view_rect.top  -param->view_rect.bot )/N};
+
+        Complex_t _c = P_MANDEL(param) ? p : param->c;
+
+        res_g[i*M+j] = _orbit_trap(p, _c, trap, P_MAXITER(param), param->interior, &early).re;
+    }
+    early_done(&group_early, early_g, early);
+}
+
+__kernel void orbit_trap_im(__global FPN       *res_g,
+                            __global FParam_t  *param,
+                            __global int       *early_g,
+                            Box_t               trap)
+{
+    __local int group_early;
+    early_begin(&group_early);
+
+    int N = param->dims.imH;
+    int M = param->dims.imW;
+    int i, j, early = 0;
+    if (pixel_of(param, &i, &j)) {
+        Complex_t p = {param->view_rect.left + j*(param->view_rect.right-param->view_rect.left)/M,
+                       param->view_rect.bot  + i*(param->view_rect.top  -param->view_rect.bot )/N};
+
+        Complex_t _c = P_MANDEL(param) ? p : param->c;
+
+        res_g[i*M+j] = _orbit_trap(p, _c, trap, P_MAXITER(param), param->interior, &early).im;
+    }
+    early_done(&group_early, early_g, early);
+}
+
+__kernel void escape_iter_pert(__global FPN         *res_g,
+                               __global FParam_t    *param,
+                               __global DeepParam_t *deep,
+                               __global Complex_t   *ref,
+                               __global int         *glitch_g)
 {
     int i = get_global_id(0);
     int j = get_global_id(1);
-    int N = get_global_size(0);
-    int M = get_global_size(1);
+    int N = param->dims.imH;
+    int M = param->dims.imW;
 
-    Complex_t p = {param->view_rect.left + j*(param->view_rect.right-param->view_rect.left)/M,
-                   param->view_rect.bot  + i*(param->view_rect.top  -param->view_rect.bot )/N};
+    if (deep->pass > 0 && !glitch_g[i*M+j])
+        return;
 
-    Complex_t _c = param->mandel ? p : param->c;
+    Complex_t d  = {deep->offset.re + j*deep->step.re,
+                    deep->offset.im + i*deep->step.im};
+    Complex_t dc = P_MANDEL(param) ? d : (Complex_t){FZERO, FZERO};
 
-    res_g[i*M+j] = _escape_iter(p, _c, param->MAXITER);
+    int glitch = 0;
+    res_g[i*M+j] = ((FPN) _escape_iter_pert(d, dc, ref, deep->ref_len, P_MAXITER(param), &glitch))/((FPN) P_MAXITER(param));
+    glitch_g[i*M+j] = glitch;
 }
 
-__kernel void escape_iter_fpn(__global FPN *res_g,
-                              __global FParam_t *param)
+__kernel void min_prox_pert(__global FPN         *res_g,
+                            __global FParam_t    *param,
+                            __global DeepParam_t *deep,
+                            __global Complex_t   *ref,
+                            __global int         *glitch_g,
+                            int                   PROXTYPE)
 {
     int i = get_global_id(0);
     int j = get_global_id(1);
-    int N = get_global_size(0);
-    int M = get_global_size(1);
+    int N = param->dims.imH;
+    int M = param->dims.imW;
 
-    Complex_t p = {param->view_rect.left + j*(param->view_rect.right-param->view_rect.left)/M,
-                   param->view_rect.bot  + i*(param->view_rect.top  -param->view_rect.bot )/N};
+    if (deep->pass > 0 && !glitch_g[i*M+j])
+        return;
 
-    Complex_t _c = param->mandel ? p : param->c;
+    Complex_t d  = {deep->offset.re + j*deep->step.re,
+                    deep->offset.im + i*deep->step.im};
+    Complex_t dc = P_MANDEL(param) ? d : (Complex_t){FZERO, FZERO};
 
-    res_g[i*M+j] = ((FPN) _escape_iter(p, _c, param->MAXITER))/((FPN) param->MAXITER);
+    int glitch = 0;
+    res_g[i*M+j] = _minprox_pert(d, dc, ref, deep->ref_len, P_MAXITER(param), P_PROXTYPE(PROXTYPE), &glitch);
+    glitch_g[i*M+j] = glitch;
 }
 
-__kernel void min_prox(__global FPN *res_g,
-                       __global FParam_t *param,
-                       __global      int *PROXTYPE)
+__kernel void orbit_trap_pert_re(__global FPN         *res_g,
+                                 __global FParam_t    *param,
+                                 __global DeepParam_t *deep,
+                                 __global Complex_t   *ref,
+                                 __global int         *glitch_g,
+                                 Box_t                 trap)
 {
     int i = get_global_id(0);
     int j = get_global_id(1);
-    int N = get_global_size(0);
-    int M = get_global_size(1);
+    int N = param->dims.imH;
+    int M = param->dims.imW;
 
-    Complex_t p = {param->view_rect.left + j*(param->view_rect.right-param->view_rect.left)/M,
-                   param->view_rect.bot  + i*(param->view_rect.top  -param->view_rect.bot )/N};
+    if (deep->pass > 0 && !glitch_g[i*M+j])
+        return;
 
-    Complex_t _c = param->mandel ? p : param->c;
+    Complex_t d  = {deep->offset.re + j*deep->step.re,
+                    deep->offset.im + i*deep->step.im};
+    Complex_t dc = P_MANDEL(param) ? d : (Complex_t){FZERO, FZERO};
+    Complex_t _c = P_MANDEL(param) ? complex_add(ref[0], d) : param->c;
 
-    res_g[i*M+j] = _minprox(p, _c, param->MAXITER, *PROXTYPE);
+    int glitch = 0;
+    res_g[i*M+j] = _orbit_trap_pert(d, dc, _c, trap, ref, deep->ref_len, P_MAXITER(param), &glitch).re;
+    glitch_g[i*M+j] = glitch;
 }
 
-__kernel void orbit_trap(__global Complex_t *res_g,
-                         __global FParam_t  *param,
-                         __global Box_t     *trap)
+__kernel void orbit_trap_pert_im(__global FPN         *res_g,
+                                 __global FParam_t    *param,
+                                 __global DeepParam_t *deep,
+                                 __global Complex_t   *ref,
+                                 __global int         *glitch_g,
+                                 Box_t                 trap)
 {
     int i = get_global_id(0);
     int j = get_global_id(1);
-    int N = get_global_size(0);
-    int M = get_global_size(1);
+    int N = param->dims.imH;
+    int M = param->dims.imW;
 
-    Complex_t p = {param->view_rect.left + j*(param->view_rect.right-param->view_rect.left)/M,
-                   param->view_rect.bot  + i*(param->view_rect.top  -param->view_rect.bot )/N};
+    if (deep->pass > 0 && !glitch_g[i*M+j])
+        return;
 
-    Complex_t _c = param->mandel ? p : param->c;
+    Complex_t d  = {deep->offset.re + j*deep->step.re,
+                    deep->offset.im + i*deep->step.im};
+    Complex_t dc = P_MANDEL(param) ? d : (Complex_t){FZERO, FZERO};
+    Complex_t _c = P_MANDEL(param) ? complex_add(ref[0], d) : param->c;
 
-    res_g[i*M+j] = _orbit_trap(p, _c, *trap, param->MAXITER);
+    int glitch = 0;
+    res_g[i*M+j] = _orbit_trap_pert(d, dc, _c, trap, ref, deep->ref_len, P_MAXITER(param), &glitch).im;
+    glitch_g[i*M+j] = glitch;
 }
 
-__kernel void orbit_trap_re(__global FPN       *res_g,
-                            __global FParam_t  *param,
-                            __global Box_t     *trap)
+// double-float versions of the field kernels, see DFParam_t
+
+__kernel void escape_iter_df(__global FPN      *res_g,
+                             __global FParam_t *param,
+                             __global int      *early_g,
+                             DFParam_t          view)
+{
+    __local int group_early;
+    early_begin(&group_early);
+
+    int M = param->dims.imW;
+    int i, j, early = 0;
+    if (pixel_of(param, &i, &j)) {
+        DFComplex_t p  = df_point(view, i, j);
+        DFComplex_t _c = P_MANDEL(param) ? p : view.c;
+
+        res_g[i*M+j] = ((FPN) _escape_iter_df(p, _c, P_MAXITER(param), param->interior, &early))/((FPN) P_MAXITER(param));
+    }
+    early_done(&group_early, early_g, early);
+}
+
+__kernel void min_prox_df(__global FPN      *res_g,
+                          __global FParam_t *param,
+                          __global int      *early_g,
+                          DFParam_t          view,
+                          int                PROXTYPE)
+{
+    __local int group_early;
+    early_begin(&group_early);
+
+    int M = param->dims.imW;
+    int i, j, early = 0;
+    if (pixel_of(param, &i, &j)) {
+        DFComplex_t p  = df_point(view, i, j);
+        DFComplex_t _c = P_MANDEL(param) ? p : view.c;
+
+        res_g[i*M+j] = _minprox_df(p, _c, P_MAXITER(param), P_PROXTYPE(PROXTYPE), param->interior, &early);
+    }
+    early_done(&group_early, early_g, early);
+}
+
+__kernel void orbit_trap_df_re(__global FPN      *res_g,
+                               __global FParam_t *param,
+                               __global int      *early_g,
+                               DFParam_t          view,
+                               Box_t              trap)
+{
+    __local int group_early;
+    early_begin(&group_early);
+
+    int M = param->dims.imW;
+    int i, j, early = 0;
+    if (pixel_of(param, &i, &j)) {
+        DFComplex_t p  = df_point(view, i, j);
+        DFComplex_t _c = P_MANDEL(param) ? p : view.c;
+
+        res_g[i*M+j] = _orbit_trap_df(p, _c, trap, P_MAXITER(param), param->interior, &early).re;
+    }
+    early_done(&group_early, early_g, early);
+}
+
+__kernel void orbit_trap_df_im(__global FPN      *res_g,
+                               __global FParam_t *param,
+                               __global int      *early_g,
+                               DFParam_t          view,
+                               Box_t              trap)
+{
+    __local int group_early;
+    early_begin(&group_early);
+
+    int M = param->dims.imW;
+    int i, j, early = 0;
+    if (pixel_of(param, &i, &j)) {
+        DFComplex_t p  = df_point(view, i, j);
+        DFComplex_t _c = P_MANDEL(param) ? p : view.c;
+
+        res_g[i*M+j] = _orbit_trap_df(p, _c, trap, P_MAXITER(param), param->interior, &early).im;
+    }
+    early_done(&group_early, early_g, early);
+}
+
+// float versions of the field kernels, for coarse views in double builds
+
+__kernel void escape_iter_f32(__global FPN      *res_g,
+                              __global FParam_t *param,
+                              __global int      *early_g)
+{
+    __local int group_early;
+    early_begin(&group_early);
+
+    int N = param->dims.imH;
+    int M = param->dims.imW;
+    int i, j, early = 0;
+    if (pixel_of(param, &i, &j)) {
+        Complex_t p = {param->view_rect.left + j*(param->view_rect.right-param->view_rect.left)/M,
+                       param->view_rect.bot  + i*(param->view_rect.top  -param->view_rect.bot )/N};
+
+        ComplexF_t pf = f32_of(p);
+        ComplexF_t _c = P_MANDEL(param) ? pf : f32_of(param->c);
+
+        res_g[i*M+j] = ((FPN) _escape_iter_f32(pf, _c, P_MAXITER(param), param->interior, &early))/((FPN) P_MAXITER(param));
+    }
+    early_done(&group_early, early_g, early);
+}
+
+__kernel void min_prox_f32(__global FPN      *res_g,
+                           __global FParam_t *param,
+                           __global int      *early_g,
+                           int                PROXTYPE)
+{
+    __local int group_early;
+    early_begin(&group_early);
+
+    int N = param->dims.imH;
+    int M = param->dims.imW;
+    int i, j, early = 0;
+    if (pixel_of(param, &i, &j)) {
+        Complex_t p = {param->view_rect.left + j*(param->view_rect.right-param->view_rect.left)/M,
+                       param->view_rect.bot  + i*(param->view_rect.top  -param->view_rect.bot )/N};
+
+        ComplexF_t pf = f32_of(p);
+        ComplexF_t _c = P_MANDEL(param) ? pf : f32_of(param->c);
+
+        res_g[i*M+j] = _minprox_f32(pf, _c, P_MAXITER(param), P_PROXTYPE(PROXTYPE), param->interior, &early);
+    }
+    early_done(&group_early, early_g, early);
+}
+
+__kernel void orbit_trap_f32_re(__global FPN      *res_g,
+                                __global FParam_t *param,
+                                __global int      *early_g,
+                                Box_t              trap)
+{
+    __local int group_early;
+    early_begin(&group_early);
+
+    int N = param->dims.imH;
+    int M = param->dims.imW;
+    int i, j, early = 0;
+    if (pixel_of(param, &i, &j)) {
+        Complex_t p = {param->view_rect.left + j*(param->view_rect.right-param->view_rect.left)/M,
+                       param->view_rect.bot  + i*(param->view_rect.top  -param->view_rect.bot )/N};
+
+        ComplexF_t pf = f32_of(p);
+        ComplexF_t _c = P_MANDEL(param) ? pf : f32_of(param->c);
+
+        res_g[i*M+j] = _orbit_trap_f32(pf, _c, trap, P_MAXITER(param), param->interior, &early).re;
+    }
+    early_done(&group_early, early_g, early);
+}
+
+__kernel void orbit_trap_f32_im(__global FPN      *res_g,
+                                __global FParam_t *param,
+                                __global int      *early_g,
+                                Box_t              trap)
+{
+    __local int group_early;
+    early_begin(&group_early);
+
+    int N = param->dims.imH;
+    int M = param->dims.imW;
+    int i, j, early = 0;
+    if (pixel_of(param, &i, &j)) {
+        Complex_t p = {param->view_rect.left + j*(param->view_rect.right-param->view_rect.left)/M,
+                       param->view_rect.bot  + i*(param->view_rect.top  -param->view_rect.bot )/N};
+
+        ComplexF_t pf = f32_of(p);
+        ComplexF_t _c = P_MANDEL(param) ? pf : f32_of(param->c);
+
+        res_g[i*M+j] = _orbit_trap_f32(pf, _c, trap, P_MAXITER(param), param->interior, &early).im;
+    }
+    early_done(&group_early, early_g, early);
+}
+
+__kernel void shift_field(__global FPN *dst_g,
+                          __global FPN *src_g,
+                          int           di,
+                          int           dj)
+// dst[i, j] = src[i + di, j + dj], pixels with no source are left as is
 {
     int i = get_global_id(0);
     int j = get_global_id(1);
     int N = get_global_size(0);
     int M = get_global_size(1);
 
-    Complex_t p = {param->view_rect.left + j*(param->view_rect.right-param->view_rect.left)/M,
-                   param->view_rect.bot  + i*(param->view_rect.top  -param->view_rect.bot )/N};
-
-    Complex_t _c = param->mandel ? p : param->c;
+    int _i = i + di;
+    int _j = j + dj;
 
-    res_g[i*M+j] = _orbit_trap(p, _c, *trap, param->MAXITER).re;
+    if (_i >= 0 && _i < N && _j >= 0 && _j < M)
+        dst_g[i*M+j] = src_g[_i*M+_j];
 }
 
-__kernel void orbit_trap_im(__global FPN       *res_g,
-                            __global FParam_t  *param,
-                            __global Box_t     *trap)
+__kernel void fill_blocks(__global FPN *res_g,
+                          int           step)
+// spreads each computed sample over its step x step block
 {
     int i = get_global_id(0);
     int j = get_global_id(1);
     int N = get_global_size(0);
     int M = get_global_size(1);
 
+    int _i = i - i%step;
+    int _j = j - j%step;
+
+    if (_i != i || _j != j)
+        res_g[i*M+j] = res_g[_i*M+_j];
+}
+
+// Mariani-Silver subdivision of escape_iter_fpn, in levels of halving tile
+// size s. ms_border computes the borders of the active tiles, ms_check fills
+// the tiles whose border is a single value and activates the s/2 children of
+// the others, and after the smallest level ms_rest computes whatever is left.
+// Activity flags are per tile, row major over the tile grid of that level.
+
+inline FPN ms_escape(__global FParam_t *param, int *early, int i, int j)
+{
+    int N = param->dims.imH;
+    int M = param->dims.imW;
+
     Complex_t p = {param->view_rect.left + j*(param->view_rect.right-param->view_rect.left)/M,
                    param->view_rect.bot  + i*(param->view_rect.top  -param->view_rect.bot )/N};
 
-    Complex_t _c = param->mandel ? p : param->c;
+    Complex_t _c = P_MANDEL(param) ? p : param->c;
 
-    res_g[i*M+j] = _orbit_trap(p, _c, *trap, param->MAXITER).im;
+    return ((FPN) _escape_iter(p, _c, P_MAXITER(param), param->interior, early))/((FPN) P_MAXITER(param));
+}
+
+inline int ms_on_border(int i, int j, int s, int N, int M)
+{
+    return i%s == 0 || i%s == s-1 || i == N-1 ||
+           j%s == 0 || j%s == s-1 || j == M-1;
+}
+
+__kernel void ms_border(__global FPN      *res_g,
+                        __global FParam_t *param,
+                        __global int      *early_g,
+                        __global int      *active_g,
+                        int                s,
+                        int                first) // all tiles active
+{
+    __local int group_early;
+    early_begin(&group_early);
+
+    int i = get_global_id(0);
+    int j = get_global_id(1);
+    int N = param->dims.imH;
+    int M = param->dims.imW;
+    int TM = (M + s - 1)/s;
+
+    int early = 0;
+    if ((first || active_g[(i/s)*TM + j/s]) && ms_on_border(i, j, s, N, M) &&
+        (first || !ms_on_border(i, j, 2*s, N, M))) // else done by the parent tile
+        res_g[i*M+j] = ms_escape(param, &early, i, j);
+    early_done(&group_early, early_g, early);
+}
+
+__kernel void ms_check(__global FPN      *res_g,
+                       __global FParam_t *param,
+                       __global int      *active_g,
+                       __global int      *next_g,
+                       int                s,
+                       int                first)
+// one work item per tile of the level
+{
+    int ti = get_global_id(0);
+    int tj = get_global_id(1);
+    int TM = get_global_size(1);
+    int N = param->dims.imH;
+    int M = param->dims.imW;
+
+    int i0 = ti*s, i1 = min(i0 + s, N);
+    int j0 = tj*s, j1 = min(j0 + s, M);
+
+    int split = 0;
+    if (first || active_g[ti*TM + tj]) {
+        FPN v = res_g[i0*M+j0];
+        for (int j = j0; j < j1; j++)
+            split |= res_g[i0*M+j] != v || res_g[(i1-1)*M+j] != v;
+        for (int i = i0; i < i1; i++)
+            split |= res_g[i*M+j0] != v || res_g[i*M+j1-1] != v;
+
+        if (!split) {
+            for (int i = i0+1; i < i1-1; i++) {
+                for (int j = j0+1; j < j1-1; j++)
+                    res_g[i*M+j] = v;
+            }
+        }
+    }
+
+    int h = s/2;
+    int CN = (N + h - 1)/h;
+    int CM = (M + h - 1)/h;
+    for (int a = 0; a < 2; a++) {
+        for (int b = 0; b < 2; b++) {
+            int ci = 2*ti + a;
+            int cj = 2*tj + b;
+            if (ci < CN && cj < CM)
+                next_g[ci*CM + cj] = split;
+        }
+    }
+}
+
+__kernel void ms_rest(__global FPN      *res_g,
+                      __global FParam_t *param,
+                      __global int      *early_g,
+                      __global int      *active_g, // of the s/2 children
+                      int                s)
+{
+    __local int group_early;
+    early_begin(&group_early);
+
+    int i = get_global_id(0);
+    int j = get_global_id(1);
+    int N = param->dims.imH;
+    int M = param->dims.imW;
+    int h = s/2;
+    int CM = (M + h - 1)/h;
+
+    int early = 0;
+    if (active_g[(i/h)*CM + j/h] && !ms_on_border(i, j, s, N, M))
+        res_g[i*M+j] = ms_escape(param, &early, i, j);
+    early_done(&group_early, early_g, early);
 }
 
 __kernel void map_img   (__global Complex_t *res_g, // result of orbit trap
                          __global Pixel_t   *sim_g, // sample image
                          __global Pixel_t   *mim_g, // mapped image
-                         __global ImDims_t  *dims)
+                         ImDims_t             dims)
 {
     int i = get_global_id(0);
     int j = get_global_id(1);
     int N = get_global_size(0);
     int M = get_global_size(1);
 
-    int _i = (int) ( ((float) (dims->imH-1)) * res_g[i*M+j].im );
-    int _j = (int) ( ((float) (dims->imW-1)) * res_g[i*M+j].re );
+    int _i = (int) ( ((float) (dims.imH-1)) * res_g[i*M+j].im );
+    int _j = (int) ( ((float) (dims.imW-1)) * res_g[i*M+j].re );
 
-    mim_g[i*M+j] = sim_g[_i*dims->imW + _j];
+    mim_g[i*M+j] = sim_g[_i*dims.imW + _j];
 
 }
 
@@ -144,17 +648,17 @@ __kernel void map_img2  (__global FPN     *res1_g,
                          __global FPN     *res2_g,
                          __global Pixel_t   *sim_g, // sample image
                          __global Pixel_t   *mim_g, // mapped image
-                         __global ImDims_t  *dims)
+                         ImDims_t             dims)
 {
     int i = get_global_id(0);
     int j = get_global_id(1);
     int N = get_global_size(0);
     int M = get_global_size(1);
 
-    int _i = (int) ( ((float) (dims->imH-1)) * res1_g[i*M+j] );
-    int _j = (int) ( ((float) (dims->imW-1)) * res2_g[i*M+j] );
+    int _i = (int) ( ((float) (dims.imH-1)) * res1_g[i*M+j] );
+    int _j = (int) ( ((float) (dims.imW-1)) * res2_g[i*M+j] );
 
-    mim_g[i*M+j] = sim_g[_i*dims->imW + _j];
+    mim_g[i*M+j] = sim_g[_i*dims.imW + _j];
 
 }
 
@@ -189,15 +693,249 @@ __kernel void pack_norm(__global FPN     *res1_g,
 
 __kernel void map_sines(__global FPN     *res_g,
                         __global Pixel_t *img_g,
-                        __global Freqs_t *freqs_g)
+                        Freqs_t           freqs)
 {
     int i = get_global_id(0);
     int j = get_global_id(1);
     int N = get_global_size(0);
     int M = get_global_size(1);
 
-    img_g[i*M+j] = (Pixel_t){127*(sin(res_g[i*M+j]*freqs_g->f1)+1), 
-                             127*(sin(res_g[i*M+j]*freqs_g->f2)+1), 
-                             127*(sin(res_g[i*M+j]*freqs_g->f3)+1)};
+    img_g[i*M+j] = (Pixel_t){127*(sin(res_g[i*M+j]*freqs.f1)+1), 
+                             127*(sin(res_g[i*M+j]*freqs.f2)+1), 
+                             127*(sin(res_g[i*M+j]*freqs.f3)+1)};
+
+}
+
+// Field statistics (see FieldStats_t), for channel ch of stats_g and cdf_g.
+// field_minmax leaves a min and max per work-group in part_g, which a single
+// work-group of stats_range reduces, starting the histogram over min..max.
+// field_hist bins the values in local memory and a single work-group of
+// hist_cdf finishes the stats, twice, the first time refining the range. All
+// run with work-groups of sizes that are powers of two up to REDUCE_SIZE, the
+// strided ones with fixed numbers of them
+#define REDUCE_SIZE 256
+
+__kernel void field_minmax(__global FPN *res_g,
+                           __global FPN *part_g,
+                           int           n)
+{
+    __local FPN lmin[REDUCE_SIZE];
+    __local FPN lmax[REDUCE_SIZE];
+    int l = get_local_id(0);
+
+    FPN min = INFINITY, max = -INFINITY;
+    for (int k = get_global_id(0); k < n; k += get_global_size(0)) {
+        FPN v = res_g[k];
+        if (isfinite(v)) {
+            min = fmin(min, v);
+            max = fmax(max, v);
+        }
+    }
+
+    lmin[l] = min;
+    lmax[l] = max;
+    for (int s = get_local_size(0)/2; s > 0; s /= 2) {
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (l < s) {
+            lmin[l] = fmin(lmin[l], lmin[l+s]);
+            lmax[l] = fmax(lmax[l], lmax[l+s]);
+        }
+    }
+    if (l == 0) {
+        part_g[2*get_group_id(0)] = lmin[0];
+        part_g[2*get_group_id(0)+1] = lmax[0];
+    }
+}
+
+__kernel void stats_range(__global FPN          *part_g,
+                          __global FieldStats_t *stats_g,
+                          __global int          *hist_g,
+                          int                    groups, // of field_minmax
+                          int                    ch)
+{
+    __local FPN lmin[REDUCE_SIZE];
+    __local FPN lmax[REDUCE_SIZE];
+    int l = get_local_id(0);
+    int ls = get_local_size(0);
+
+    FPN min = INFINITY, max = -INFINITY;
+    for (int g = l; g < groups; g += ls) {
+        min = fmin(min, part_g[2*g]);
+        max = fmax(max, part_g[2*g+1]);
+    }
+    for (int b = l; b < HIST_BINS + 2; b += ls)
+        hist_g[b] = 0;
+
+    lmin[l] = min;
+    lmax[l] = max;
+    for (int s = ls/2; s > 0; s /= 2) {
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (l < s) {
+            lmin[l] = fmin(lmin[l], lmin[l+s]);
+            lmax[l] = fmax(lmax[l], lmax[l+s]);
+        }
+    }
+    if (l == 0) {
+        FieldStats_t s = {lmin[0], lmax[0]};
+        s.hmin = s.min;
+        s.hmax = s.max;
+        stats_g[ch] = s;
+    }
+}
+
+__kernel void field_hist(__global FPN          *res_g,
+                         __global FieldStats_t *stats_g,
+                         __global int          *hist_g,
+                         int                    n,
+                         int                    ch)
+{
+    __local int lhist[HIST_BINS + 2];
+    int l = get_local_id(0);
+    int ls = get_local_size(0);
+
+    for (int b = l; b < HIST_BINS + 2; b += ls)
+        lhist[b] = 0;
+    FieldStats_t s = stats_g[ch];
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int k = get_global_id(0); k < n; k += get_global_size(0)) {
+        FPN v = res_g[k];
+        if (isfinite(v))
+            atomic_inc(&lhist[hist_bin(v, s)]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int b = l; b < HIST_BINS + 2; b += ls) {
+        if (lhist[b])
+            atomic_add(&hist_g[b], lhist[b]);
+    }
+}
+
+__kernel void hist_cdf(__global int          *hist_g,
+                       __global FieldStats_t *stats_g,
+                       __global float        *cdf_g,
+                       float                  clip,
+                       int                    ch,
+                       int                    refine)
+// hist_finish with each work item on a run of bins, after a scan of their sums
+{
+    __local int lsum[REDUCE_SIZE];
+    __local int lbin[2]; // of the percentiles
+    __local FPN lpct[2];
+    int l = get_local_id(0);
+    int ls = get_local_size(0);
+    int per = HIST_BINS / ls;
+    int b0 = l * per;
+
+    FieldStats_t s = stats_g[ch];
+    if (l == 0) {
+        lbin[0] = 0;
+        lbin[1] = HIST_BINS - 1;
+        lpct[0] = s.hmin;
+        lpct[1] = s.hmax;
+    }
+    int sum = 0;
+    for (int b = b0; b < b0 + per; b++)
+        sum += hist_g[b];
+    lsum[l] = sum;
+    for (int d = 1; d < ls; d *= 2) { // inclusive
+        barrier(CLK_LOCAL_MEM_FENCE);
+        int add = l >= d ? lsum[l-d] : 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        lsum[l] += add;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    int below = hist_g[HIST_BINS];
+    hist_start(&s, below, hist_g[HIST_BINS+1], lsum[ls-1]);
+    int lo_bin = -1, hi_bin = -1;
+    int prev = below + lsum[l] - sum;
+    for (int b = b0; b < b0 + per; b++) {
+        int upto = prev + hist_g[b];
+        hist_finish_bin(&s, clip, b, prev, upto, cdf_g + ch*HIST_BINS,
+                        &lo_bin, &hi_bin);
+        prev = upto;
+    }
+    // each percentile falls in one bin at most
+    if (lo_bin >= 0) {
+        lbin[0] = lo_bin;
+        lpct[0] = s.lo;
+    }
+    if (hi_bin >= 0) {
+        lbin[1] = hi_bin;
+        lpct[1] = s.hi;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+
+    if (l == 0) {
+        s.lo = lpct[0];
+        s.hi = lpct[1];
+        hist_end(&s, lbin[0], lbin[1], refine);
+        stats_g[ch] = s;
+    }
+    if (refine) {
+        for (int b = l; b < HIST_BINS + 2; b += ls)
+            hist_g[b] = 0;
+    }
+}
+
+// the colormaps above on the fields as tone mapped by tone_map, with the
+// stats and cdf of channel k for res(k+1)_g
+
+__kernel void map_sines_tone(__global FPN          *res_g,
+                             __global Pixel_t      *img_g,
+                             Freqs_t                freqs,
+                             __global FieldStats_t *stats_g,
+                             __global float        *cdf_g,
+                             int                    tone)
+{
+    int i = get_global_id(0);
+    int j = get_global_id(1);
+    int M = get_global_size(1);
+
+    FPN x = tone_map(res_g[i*M+j], stats_g[0], cdf_g, tone);
+    img_g[i*M+j] = (Pixel_t){127*(sin(x*freqs.f1)+1),
+                             127*(sin(x*freqs.f2)+1),
+                             127*(sin(x*freqs.f3)+1)};
+}
+
+__kernel void map_img2_tone(__global FPN          *res1_g,
+                            __global FPN          *res2_g,
+                            __global Pixel_t      *sim_g, // sample image
+                            __global Pixel_t      *mim_g, // mapped image
+                            ImDims_t               dims,
+                            __global FieldStats_t *stats_g,
+                            __global float        *cdf_g,
+                            int                    tone)
+{
+    int i = get_global_id(0);
+    int j = get_global_id(1);
+    int M = get_global_size(1);
+
+    FPN u = tone_map(res1_g[i*M+j], stats_g[0], cdf_g, tone);
+    FPN v = tone_map(res2_g[i*M+j], stats_g[1], cdf_g + HIST_BINS, tone);
+    int _i = (int) ( ((float) (dims.imH-1)) * u );
+    int _j = (int) ( ((float) (dims.imW-1)) * v );
+
+    mim_g[i*M+j] = sim_g[_i*dims.imW + _j];
+}
+
+__kernel void pack_tone(__global FPN          *res1_g,
+                        __global FPN          *res2_g,
+                        __global FPN          *res3_g,
+                        __global Pixel_t      *img_g,
+                        __global FieldStats_t *stats_g,
+                        __global float        *cdf_g,
+                        int                    tone,
+                        int                    norm)
+{
+    int i = get_global_id(0);
+    int j = get_global_id(1);
+    int M = get_global_size(1);
 
+    FPN r = tone_map(res1_g[i*M+j], stats_g[0], cdf_g, tone);
+    FPN g = tone_map(res2_g[i*M+j], stats_g[1], cdf_g + HIST_BINS, tone);
+    FPN b = tone_map(res3_g[i*M+j], stats_g[2], cdf_g + 2*HIST_BINS, tone);
+    FPN s = norm ? r+g+b : FONE;
+    img_g[i*M+j] = (Pixel_t){255*r/s, 255*g/s, 255*b/s};
 }
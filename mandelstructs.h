@@ -1,3 +1,6 @@
+#ifndef MANDELSTRUCTS_H
+#define MANDELSTRUCTS_H
+
 #ifdef USE_FLOAT
 typedef float FPN;
 #define FZERO 0
@@ -26,21 +29,85 @@ typedef struct Pixel {
   unsigned char b;
 } Pixel_t;
 
+typedef struct ImDims {
+  int imH;
+  int imW;
+} ImDims_t;
+
 typedef struct FParam {
   // General fract iter params
   int mandel;  // mandel or julia
   Complex_t c; // not given when mandel selected
   Box_t view_rect;
   int MAXITER;
+  ImDims_t dims; // of the whole field, kernels may run on a sub range of it
+  int step;      // progressive passes only compute every step-th pixel,
+  int skip;      // leaving those on the skip grid (done by the last pass)
+  int interior;  // INTERIOR_* bits, early exits for points in the set
 } FParam_t;
 
-typedef struct ImDims {
-  int imH;
-  int imW;
-} ImDims_t;
+#define INTERIOR_BULBS 1  // main cardioid and period 2 bulb, z^2 + c only
+#define INTERIOR_PERIOD 2 // exactly repeating orbits
+
+typedef struct DeepParam {
+  // Perturbation pixel mapping, relative to the reference point
+  Complex_t offset; // pixel (0, 0)
+  Complex_t step;   // per column (re) and per row (im)
+  int ref_len;      // entries in reference orbit
+  int pass;         // 0 computes every pixel, later passes only glitched ones
+} DeepParam_t;
+
+// Double-float, the unevaluated sum hi + lo of two floats (|lo| at most half
+// an ulp of hi), for ~44 bit mantissas from float arithmetic only
+typedef struct DF {
+  float hi;
+  float lo;
+} DF_t;
+
+typedef struct DFComplex {
+  DF_t re;
+  DF_t im;
+} DFComplex_t;
+
+typedef struct DFParam {
+  // Double-float pixel mapping, pixel (i, j) is origin + (j step_re, i step_im)
+  DFComplex_t origin;
+  DF_t step_re;
+  DF_t step_im;
+  DFComplex_t c; // julia constant
+} DFParam_t;
+
+// Single precision point, for the float kernels of double builds
+typedef struct ComplexF {
+  float re;
+  float im;
+} ComplexF_t;
+
+// Of a field, reduced on the device for the tone mapping of the colormaps.
+// Values that are not finite are left out. The histogram is taken over min..max
+// first, then again over the bins holding the percentiles, for their precision
+// despite outliers
+#define HIST_BINS 1024
+typedef struct FieldStats {
+  FPN min;
+  FPN max;
+  FPN lo; // clip and 1 - clip percentiles, interpolated from the histogram
+  FPN hi;
+  FPN hmin; // range of the histogram, and so of the cdf
+  FPN hmax;
+  int count;   // of finite values
+  float below; // fraction of the count under hmin
+} FieldStats_t;
+
+// what the colormaps are given of a field value
+#define TONE_FIXED 0    // the value itself
+#define TONE_RANGE 1    // lo..hi stretched to 0..1 and clamped
+#define TONE_EQUALIZE 2 // the fraction of the field below it
 
 typedef struct Freqs {
   FPN f1;
   FPN f2;
   FPN f3;
 } Freqs_t;
+
+#endif
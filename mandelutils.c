@@ -4,6 +4,13 @@
 #endif
 
 // add macro to detect if gcc or opencl and use corresponding builtins?
+
+// address space of arrays handed down from kernels
+#ifdef __OPENCL_VERSION__
+#define GMEM __global
+#else
+#define GMEM
+#endif
 inline FPN _abs(FPN x) { return x > 0 ? x : -x; }
 
 inline FPN _min(FPN a, FPN b) { return a < b ? a : b; }
@@ -23,6 +30,11 @@ Complex_t complex_mult(Complex_t a, Complex_t b) {
 }
 
 Complex_t complex_pow(Complex_t z, int n) {
+#ifdef SPEC_POWER
+  // every call in f has this exponent (see FractalCompute::spec_power), the
+  // loop can then be unrolled
+  n = SPEC_POWER;
+#endif
   Complex_t p = z;
   for (int i = 1; i < n; i++) {
     p = complex_mult(p, z);
@@ -68,41 +80,507 @@ FPN proximity(Complex_t z, int PROXTYPE)
   return res;
 }
 
-int _escape_iter(Complex_t z, Complex_t c, int MAXITER) {
+////////////////////////////////////////////////////////////////////////////
+//// Interior detection
+// Points in the set always run to MAXITER, so the routines below can stop
+// early on them, as selected by the INTERIOR_* bits. Either way the result is
+// the same as that of the full iteration, and *early is set when stopped.
+
+// c in the main cardioid or the period 2 bulb, so bounded under z^2 + c, only
+// valid for the default function in mandelbrot mode
+int in_main_bulbs(Complex_t c) {
+  FPN x = c.re - (FPN)0.25;
+  FPN y2 = c.im * c.im;
+  FPN q = x * x + y2;
+  if (q * (q + x) < (FPN)0.25 * y2)
+    return 1;
+  x = c.re + FONE;
+  return x * x + y2 < (FPN)0.0625;
+}
+
+// Brent style cycle detection, z is compared against a saved point that is
+// moved up to it at power of two intervals. Only exact repeats count, after
+// which the (deterministic) orbit can only go round the same cycle again
+typedef struct Period {
+  Complex_t saved;
+  int since;
+  int interval;
+} Period_t;
+
+inline Period_t period_start(Complex_t z) {
+  Period_t p = {z, 0, 1};
+  return p;
+}
+
+inline int period_found(Period_t *p, Complex_t z) {
+  if (z.re == p->saved.re && z.im == p->saved.im)
+    return 1;
+  if (++p->since == p->interval) {
+    p->saved = z;
+    p->since = 0;
+    p->interval *= 2;
+  }
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////
+//// Escape time routines
+
+int _escape_iter(Complex_t z, Complex_t c, int MAXITER, int interior,
+                 int *early) {
+
+  if ((interior & INTERIOR_BULBS) && in_main_bulbs(c)) {
+    *early = 1;
+    return MAXITER;
+  }
 
+  Period_t period = period_start(z);
   int i = 0;
   while (i < MAXITER && in_bounds(z)) {
     z = f(z, c);
     i += 1;
+    if ((interior & INTERIOR_PERIOD) && period_found(&period, z)) {
+      *early = 1;
+      return MAXITER;
+    }
   }
 
   return i;
 }
 
-FPN _minprox(Complex_t z, Complex_t c, int MAXITER, int PROXTYPE)
+FPN _minprox(Complex_t z, Complex_t c, int MAXITER, int PROXTYPE,
+             int interior, int *early)
 // more of a distance field?
 {
 
+  // the whole cycle has been through dist by the time it is found
+  Period_t period = period_start(z);
   int i = 0;
   FPN dist = proximity(z, PROXTYPE);
   while (i < MAXITER && in_bounds(z)) {
     z = f(z, c);
     dist = _min(dist, proximity(z, PROXTYPE));
     i += 1;
+    if ((interior & INTERIOR_PERIOD) && period_found(&period, z)) {
+      *early = 1;
+      break;
+    }
   }
 
   return dist;
 }
 
-Complex_t _orbit_trap(Complex_t z, Complex_t c, Box_t b, int MAXITER)
+// UV coords of z in the box
+inline Complex_t trap_uv(Complex_t z, Box_t b) {
+  Complex_t res = {-b.left, -b.bot};
+  res = complex_add(res, z);
+  res.re /= (b.right - b.left);
+  res.im /= (b.top - b.bot);
+  return res;
+}
+
+Complex_t _orbit_trap(Complex_t z, Complex_t c, Box_t b, int MAXITER,
+                      int interior, int *early)
 // returns UV coords in given box
+{
+  // a cycle that missed the box so far never reaches it
+  Period_t period = period_start(z);
+  int i = 0;
+  while (i < MAXITER) {
+    i += 1;
+    z = f(z, c);
+    if (in_box(z, b))
+      return trap_uv(z, b);
+    if ((interior & INTERIOR_PERIOD) && period_found(&period, z)) {
+      *early = 1;
+      break;
+    }
+  }
+
+  return (Complex_t){FZERO, FZERO};
+}
+
+////////////////////////////////////////////////////////////////////////////
+//// Double-float
+// Error free float transforms (Dekker, Knuth) give DF_t about twice the
+// mantissa of a float, for devices without (fast) doubles. Like the
+// perturbation routines, the orbits below are of the default z^2 + c. Only the
+// iteration needs the precision, the measures are taken on the hi parts.
+
+#ifdef __OPENCL_VERSION__
+#define FMAF fma
+#else
+#define FMAF fmaf
+#endif
+
+inline DF_t df_two_sum(float a, float b) {
+  float s = a + b;
+  float v = s - a;
+  DF_t r = {s, (a - (s - v)) + (b - v)};
+  return r;
+}
+
+// only valid for |a| >= |b|
+inline DF_t df_quick_two_sum(float a, float b) {
+  float s = a + b;
+  DF_t r = {s, b - (s - a)};
+  return r;
+}
+
+inline DF_t df_two_prod(float a, float b) {
+  float p = a * b;
+  DF_t r = {p, FMAF(a, b, -p)};
+  return r;
+}
+
+inline DF_t df_add(DF_t a, DF_t b) {
+  DF_t s = df_two_sum(a.hi, b.hi);
+  DF_t t = df_two_sum(a.lo, b.lo);
+  s = df_quick_two_sum(s.hi, s.lo + t.hi);
+  return df_quick_two_sum(s.hi, s.lo + t.lo);
+}
+
+inline DF_t df_neg(DF_t a) {
+  DF_t r = {-a.hi, -a.lo};
+  return r;
+}
+
+inline DF_t df_mul(DF_t a, DF_t b) {
+  DF_t p = df_two_prod(a.hi, b.hi);
+  return df_quick_two_sum(p.hi, p.lo + (a.hi * b.lo + a.lo * b.hi));
+}
+
+inline DF_t df_mul_f(DF_t a, float b) {
+  DF_t p = df_two_prod(a.hi, b);
+  return df_quick_two_sum(p.hi, p.lo + a.lo * b);
+}
+
+inline int df_lt(DF_t a, DF_t b) {
+  return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo);
+}
+
+inline DFComplex_t df_point(DFParam_t v, int i, int j) {
+  DFComplex_t p = {df_add(v.origin.re, df_mul_f(v.step_re, (float)j)),
+                   df_add(v.origin.im, df_mul_f(v.step_im, (float)i))};
+  return p;
+}
+
+// z^2 + c
+inline DFComplex_t df_step(DFComplex_t z, DFComplex_t c) {
+  DF_t re2 = df_mul(z.re, z.re);
+  DF_t im2 = df_mul(z.im, z.im);
+  DF_t reim = df_mul(z.re, z.im);
+  DFComplex_t r = {df_add(df_add(re2, df_neg(im2)), c.re),
+                   df_add(df_add(reim, reim), c.im)};
+  return r;
+}
+
+inline Complex_t df_hi(DFComplex_t z) {
+  Complex_t r = {(FPN)z.re.hi, (FPN)z.im.hi};
+  return r;
+}
+
+// in_main_bulbs in double-float, the cardioid boundary is where it matters
+int df_in_main_bulbs(DFComplex_t c) {
+  DF_t quarter = {0.25f, 0};
+  DF_t x = df_add(c.re, df_neg(quarter));
+  DF_t y2 = df_mul(c.im, c.im);
+  DF_t q = df_add(df_mul(x, x), y2);
+  if (df_lt(df_mul(q, df_add(q, x)), df_mul_f(y2, 0.25f)))
+    return 1;
+  DF_t one = {1, 0};
+  x = df_add(c.re, one);
+  DF_t bulb = {0.0625f, 0};
+  return df_lt(df_add(df_mul(x, x), y2), bulb);
+}
+
+inline int df_same(DFComplex_t a, DFComplex_t b) {
+  return a.re.hi == b.re.hi && a.re.lo == b.re.lo && a.im.hi == b.im.hi &&
+         a.im.lo == b.im.lo;
+}
+
+// period_found on the full double-float value
+typedef struct DFPeriod {
+  DFComplex_t saved;
+  int since;
+  int interval;
+} DFPeriod_t;
+
+inline int df_period_found(DFPeriod_t *p, DFComplex_t z) {
+  if (df_same(z, p->saved))
+    return 1;
+  if (++p->since == p->interval) {
+    p->saved = z;
+    p->since = 0;
+    p->interval *= 2;
+  }
+  return 0;
+}
+
+int _escape_iter_df(DFComplex_t z, DFComplex_t c, int MAXITER, int interior,
+                    int *early) {
+  if ((interior & INTERIOR_BULBS) && df_in_main_bulbs(c)) {
+    *early = 1;
+    return MAXITER;
+  }
+
+  DFPeriod_t period = {z, 0, 1};
+  int i = 0;
+  while (i < MAXITER && in_bounds(df_hi(z))) {
+    z = df_step(z, c);
+    i += 1;
+    if ((interior & INTERIOR_PERIOD) && df_period_found(&period, z)) {
+      *early = 1;
+      return MAXITER;
+    }
+  }
+
+  return i;
+}
+
+FPN _minprox_df(DFComplex_t z, DFComplex_t c, int MAXITER, int PROXTYPE,
+                int interior, int *early) {
+  DFPeriod_t period = {z, 0, 1};
+  int i = 0;
+  FPN dist = proximity(df_hi(z), PROXTYPE);
+  while (i < MAXITER && in_bounds(df_hi(z))) {
+    z = df_step(z, c);
+    dist = _min(dist, proximity(df_hi(z), PROXTYPE));
+    i += 1;
+    if ((interior & INTERIOR_PERIOD) && df_period_found(&period, z)) {
+      *early = 1;
+      break;
+    }
+  }
+
+  return dist;
+}
+
+Complex_t _orbit_trap_df(DFComplex_t z, DFComplex_t c, Box_t b, int MAXITER,
+                         int interior, int *early) {
+  DFPeriod_t period = {z, 0, 1};
+  int i = 0;
+  while (i < MAXITER) {
+    i += 1;
+    z = df_step(z, c);
+    if (in_box(df_hi(z), b))
+      return trap_uv(df_hi(z), b);
+    if ((interior & INTERIOR_PERIOD) && df_period_found(&period, z)) {
+      *early = 1;
+      break;
+    }
+  }
+
+  return (Complex_t){FZERO, FZERO};
+}
+
+////////////////////////////////////////////////////////////////////////////
+//// Single precision
+// Float orbits of the default z^2 + c, for views coarse enough that doubles
+// only cost time (up to 32 times slower on consumer GPUs). Points and results
+// are FPN, everything in the loop is float. With float FPN these are the
+// escape time routines above.
+
+inline ComplexF_t f32_of(Complex_t z) {
+  ComplexF_t r = {(float)z.re, (float)z.im};
+  return r;
+}
+
+inline Complex_t f32_fpn(ComplexF_t z) {
+  Complex_t r = {(FPN)z.re, (FPN)z.im};
+  return r;
+}
+
+inline ComplexF_t f32_step(ComplexF_t z, ComplexF_t c) {
+  ComplexF_t r = {z.re * z.re - z.im * z.im + c.re, 2 * z.re * z.im + c.im};
+  return r;
+}
+
+inline int f32_in_bounds(ComplexF_t z) { return z.re * z.re + z.im * z.im < 4; }
+
+inline int f32_in_box(ComplexF_t z, Box_t b) {
+  return z.re > (float)b.left && z.re < (float)b.right &&
+         z.im > (float)b.bot && z.im < (float)b.top;
+}
+
+// proximity in float
+float f32_proximity(ComplexF_t z, int PROXTYPE) {
+  float res = 1000;
+  if (PROXTYPE & 1)
+    res = fminf(res, z.re * z.re + z.im * z.im);
+  if (PROXTYPE & 2)
+    res = fminf(res, z.re > 0 ? z.re : -z.re);
+  if (PROXTYPE & 4)
+    res = fminf(res, z.im > 0 ? z.im : -z.im);
+  return res;
+}
+
+typedef struct F32Period {
+  ComplexF_t saved;
+  int since;
+  int interval;
+} F32Period_t;
+
+inline int f32_period_found(F32Period_t *p, ComplexF_t z) {
+  if (z.re == p->saved.re && z.im == p->saved.im)
+    return 1;
+  if (++p->since == p->interval) {
+    p->saved = z;
+    p->since = 0;
+    p->interval *= 2;
+  }
+  return 0;
+}
+
+int _escape_iter_f32(ComplexF_t z, ComplexF_t c, int MAXITER, int interior,
+                     int *early) {
+  if ((interior & INTERIOR_BULBS) && in_main_bulbs(f32_fpn(c))) {
+    *early = 1;
+    return MAXITER;
+  }
+
+  F32Period_t period = {z, 0, 1};
+  int i = 0;
+  while (i < MAXITER && f32_in_bounds(z)) {
+    z = f32_step(z, c);
+    i += 1;
+    if ((interior & INTERIOR_PERIOD) && f32_period_found(&period, z)) {
+      *early = 1;
+      return MAXITER;
+    }
+  }
+
+  return i;
+}
+
+FPN _minprox_f32(ComplexF_t z, ComplexF_t c, int MAXITER, int PROXTYPE,
+                 int interior, int *early) {
+  F32Period_t period = {z, 0, 1};
+  int i = 0;
+  float dist = f32_proximity(z, PROXTYPE);
+  while (i < MAXITER && f32_in_bounds(z)) {
+    z = f32_step(z, c);
+    dist = fminf(dist, f32_proximity(z, PROXTYPE));
+    i += 1;
+    if ((interior & INTERIOR_PERIOD) && f32_period_found(&period, z)) {
+      *early = 1;
+      break;
+    }
+  }
+
+  return dist;
+}
+
+Complex_t _orbit_trap_f32(ComplexF_t z, ComplexF_t c, Box_t b, int MAXITER,
+                          int interior, int *early) {
+  F32Period_t period = {z, 0, 1};
+  int i = 0;
+  while (i < MAXITER) {
+    i += 1;
+    z = f32_step(z, c);
+    if (f32_in_box(z, b))
+      return trap_uv(f32_fpn(z), b);
+    if ((interior & INTERIOR_PERIOD) && f32_period_found(&period, z)) {
+      *early = 1;
+      break;
+    }
+  }
+
+  return (Complex_t){FZERO, FZERO};
+}
+
+////////////////////////////////////////////////////////////////////////////
+//// Perturbation (deep zoom)
+// Pixels are iterated as an offset dz from a reference orbit ref[n] computed
+// on the host at high precision, z_n = ref[n] + dz_n. Only valid for the
+// default z^2 + c, as the delta recurrence below is derived from it.
+
+#define GLITCH_TOL 1e-6 // squared, Pauldelbrot's criterion
+
+// dz' = 2 Z dz + dz^2 + dc
+inline Complex_t pert_step(Complex_t Z, Complex_t dz, Complex_t dc) {
+  return complex_add(complex_mult(complex_add(complex_add(Z, Z), dz), dz), dc);
+}
+
+// the offset has swamped the reference, the rounded deltas can no longer be
+// trusted and the pixel needs a reference closer to it
+inline int is_glitch(Complex_t z, Complex_t Z) {
+  return z.re * z.re + z.im * z.im < GLITCH_TOL * (Z.re * Z.re + Z.im * Z.im);
+}
+
+int _escape_iter_pert(Complex_t dz, Complex_t dc, GMEM Complex_t *ref,
+                      int ref_len, int MAXITER, int *glitch) {
+
+  int i = 0;
+  Complex_t z = complex_add(ref[0], dz);
+  while (i < MAXITER && in_bounds(z)) {
+    if (i + 1 >= ref_len) { // reference escaped first
+      *glitch = 1;
+      break;
+    }
+    dz = pert_step(ref[i], dz, dc);
+    i += 1;
+    z = complex_add(ref[i], dz);
+    if (is_glitch(z, ref[i])) {
+      *glitch = 1;
+      break;
+    }
+  }
+
+  return i;
+}
+
+FPN _minprox_pert(Complex_t dz, Complex_t dc, GMEM Complex_t *ref, int ref_len,
+                  int MAXITER, int PROXTYPE, int *glitch) {
+
+  int i = 0;
+  Complex_t z = complex_add(ref[0], dz);
+  FPN dist = proximity(z, PROXTYPE);
+  while (i < MAXITER && in_bounds(z)) {
+    if (i + 1 >= ref_len) {
+      *glitch = 1;
+      break;
+    }
+    dz = pert_step(ref[i], dz, dc);
+    i += 1;
+    z = complex_add(ref[i], dz);
+    if (is_glitch(z, ref[i])) {
+      *glitch = 1;
+      break;
+    }
+    dist = _min(dist, proximity(z, PROXTYPE));
+  }
+
+  return dist;
+}
+
+Complex_t _orbit_trap_pert(Complex_t dz, Complex_t dc, Complex_t c, Box_t b,
+                           GMEM Complex_t *ref, int ref_len, int MAXITER,
+                           int *glitch)
+// c is the rounded full constant, only used once the orbit has escaped the
+// circle, from there on plain iteration is accurate enough
 {
   Complex_t res = {-b.left, -b.bot};
 
   int i = 0;
+  int escaped = 0;
+  Complex_t z = complex_add(ref[0], dz);
   while (i < MAXITER) {
+    if (escaped || !in_bounds(z)) {
+      escaped = 1;
+      z = f(z, c);
+    } else if (i + 1 < ref_len) {
+      dz = pert_step(ref[i], dz, dc);
+      z = complex_add(ref[i + 1], dz);
+      if (is_glitch(z, ref[i + 1])) {
+        *glitch = 1;
+        break;
+      }
+    } else {
+      *glitch = 1;
+      break;
+    }
     i += 1;
-    z = f(z, c);
     if (in_box(z, b)) {
       res = complex_add(res, z);
       res.re /= (b.right - b.left);
@@ -113,3 +591,97 @@ Complex_t _orbit_trap(Complex_t z, Complex_t c, Box_t b, int MAXITER)
 
   return (Complex_t){FZERO, FZERO};
 }
+
+////////////////////////////////////////////////////////////////////////////
+//// Tone mapping
+// Field statistics for the colormaps (see FieldStats_t), shared by the
+// reduction kernels and the CPU backend. Histograms have HIST_BINS equal bins
+// over hmin..hmax, then one for the values below and one for those above.
+
+inline int hist_bin(FPN v, FieldStats_t s) {
+  if (v < s.hmin)
+    return HIST_BINS;
+  if (v > s.hmax)
+    return HIST_BINS + 1;
+  int b = s.hmax > s.hmin ? (int)((v - s.hmin) / (s.hmax - s.hmin) * HIST_BINS)
+                          : 0;
+  return b < HIST_BINS ? b : HIST_BINS - 1;
+}
+
+// hist_finish in parts, so that the kernels can split the bins over a
+// work-group. hist_start takes the count of the out of range values and the
+// sum of the bins, then each bin b of the histogram holds the values ranked
+// prev..upto
+inline void hist_start(FieldStats_t *s, int below, int above, int sum) {
+  s->count = below + above + sum;
+  s->below = s->count > 0 ? (float)below / s->count : 0;
+  s->lo = s->hmin;
+  s->hi = s->hmax;
+}
+
+inline void hist_finish_bin(FieldStats_t *s, float clip, int b, int prev,
+                            int upto, GMEM float *cdf, int *lo_bin,
+                            int *hi_bin) {
+  FPN w = (s->hmax - s->hmin) / HIST_BINS;
+  FPN lo = clip * s->count, hi = (1 - clip) * s->count;
+  if (prev <= lo && lo < upto) {
+    s->lo = s->hmin + w * (b + (lo - prev) / (upto - prev));
+    *lo_bin = b;
+  }
+  if (prev < hi && hi <= upto) {
+    s->hi = s->hmin + w * (b + (hi - prev) / (upto - prev));
+    *hi_bin = b;
+  }
+  cdf[b] = s->count > 0 ? (float)upto / s->count : 0;
+}
+
+inline void hist_end(FieldStats_t *s, int lo_bin, int hi_bin, int refine) {
+  FPN w = (s->hmax - s->hmin) / HIST_BINS;
+  if (refine) {
+    s->hmax = s->hmin + w * (hi_bin + 1);
+    s->hmin = s->hmin + w * lo_bin;
+  }
+}
+
+// from the histogram, fills in the count, percentiles and cdf, the cumulative
+// histogram as fractions of the count. refine then narrows hmin..hmax to the
+// bins holding the percentiles, for the next histogram
+void hist_finish(GMEM const int *hist, FieldStats_t *s, float clip,
+                 GMEM float *cdf, int refine) {
+  int sum = 0;
+  for (int b = 0; b < HIST_BINS; b++)
+    sum += hist[b];
+  hist_start(s, hist[HIST_BINS], hist[HIST_BINS + 1], sum);
+
+  int lo_bin = 0, hi_bin = HIST_BINS - 1;
+  int prev = hist[HIST_BINS];
+  for (int b = 0; b < HIST_BINS; b++) {
+    int upto = prev + hist[b];
+    hist_finish_bin(s, clip, b, prev, upto, cdf, &lo_bin, &hi_bin);
+    prev = upto;
+  }
+  hist_end(s, lo_bin, hi_bin, refine);
+}
+
+// v as given to the colormaps in mode (TONE_*), s and cdf of v's field
+inline FPN tone_map(FPN v, FieldStats_t s, GMEM const float *cdf, int mode) {
+  if (mode == TONE_RANGE) {
+    FPN t = s.hi > s.lo ? (v - s.lo) / (s.hi - s.lo) : FZERO;
+    return t > 0 ? (t < 1 ? t : FONE) : FZERO;
+  }
+  if (mode == TONE_EQUALIZE) {
+    FPN x = s.hmax > s.hmin ? (v - s.hmin) / (s.hmax - s.hmin) * HIST_BINS
+                            : FZERO;
+    if (x != x) // not a number
+      return FZERO;
+    // out of the range of the histogram, at its ends
+    if (x <= 0)
+      return s.below;
+    if (x >= HIST_BINS)
+      return cdf[HIST_BINS - 1];
+    int b = (int)x;
+    FPN below = b > 0 ? cdf[b - 1] : s.below;
+    return below + (x - b) * (cdf[b] - below);
+  }
+  return v;
+}
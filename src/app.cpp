@@ -1,3 +1,4 @@
+#include <chrono>
 #include <cmath>
 #include <filesystem>
 #include <regex>
@@ -5,28 +6,13 @@ namespace fs = std::filesystem;
 
 #include "app.hpp"
 
-#define STB_IMAGE_IMPLEMENTATION
 #include "imgui.h"
-#include "stb_image.h"
 
 std::string App::title = "CLImFractal";
 
-App::App() {
-  N = 600;
-  M = 800;
-
+App::App() : FractalCompute(display_N, display_M) {
   strcpy(func_buff, default_recurse_func.c_str());
 
-  // ecl._verbose = true;
-  compile_kernels("");
-  ecl.no_block = true;
-
-  field1 = new SynchronisedArray<FPN>(ecl.context, CL_MEM_WRITE_ONLY, {N, M});
-  field2 = new SynchronisedArray<FPN>(ecl.context, CL_MEM_WRITE_ONLY, {N, M});
-  field3 = new SynchronisedArray<FPN>(ecl.context, CL_MEM_WRITE_ONLY, {N, M});
-  pix = new SynchronisedArray<Pixel>(ecl.context, CL_MEM_WRITE_ONLY, {N, M});
-  param = new SynchronisedArray<FParam>(ecl.context);
-
   for (const auto &entry : fs::directory_iterator("mimg")) {
     string s = entry.path();
     regex r(".*\\.(?:png|jpg)");
@@ -40,135 +26,69 @@ App::App() {
   migs_opts.push_back('\0');
 }
 
-App::~App() {
-  delete pix;
-  delete field1;
-  delete field2;
-  delete field3;
-  delete param;
-}
-
-bool App::compile_kernels(string new_func) {
-  vector<string> source_files{"mandelstructs.h", "mandelutils.c", "mandel.cl"};
-  vector<string> kernel_names{
-      "escape_iter",   "escape_iter_fpn", "min_prox", "orbit_trap",
-      "orbit_trap_re", "orbit_trap_im",   "map_img",  "map_img2",
-      "apply_log_int", "apply_log_fpn",   "pack",     "pack_norm",
-      "map_sines"};
-  string build_options =
-      "-I " + string(fs::current_path()) + " -D EXTERNAL_CONCAT";
-#ifdef USE_FLOAT
-  build_options += " -D USE_FLOAT";
-#endif
-  return ecl.load_kernels(source_files, kernel_names, build_options,
-                          "//>>(.|\n)*//<<", new_func);
-}
-
-void App::escape_iter(SynchronisedArray<FPN> *field) {
-  if (compute_enabled)
-    ecl.apply_kernel("escape_iter_fpn", *field, *param);
-}
-
-void App::min_prox(SynchronisedArray<FPN> *field, int PROXTYPE) {
-  if (compute_enabled) {
-    SynchronisedArray<int> pt(ecl.context);
-    pt[0] = PROXTYPE;
-
-    ecl.apply_kernel("min_prox", *field, *param, pt);
-  }
-}
-
-void App::orbit_trap(SynchronisedArray<FPN> *field, float bb, float bt,
-                     float bl, float br, bool real) {
-  if (compute_enabled) {
-    SynchronisedArray<Box> _box(ecl.context);
-    _box[0] = {bb, bt, bl, br};
-    string kernel = real ? "orbit_trap_re" : "orbit_trap_im";
-    ecl.apply_kernel(kernel, *field, *param, _box);
-  }
-}
-
-void App::map_sines(FPN f1, FPN f2, FPN f3) {
-  if (compute_enabled) {
-    SynchronisedArray<Freqs> freqs(ecl.context);
-    freqs[0] = {f1, f2, f3};
-
-    ecl.apply_kernel("map_sines", *field1, *pix, freqs);
-  }
-}
-
-void App::map_img(string img_file) {
-  if (compute_enabled) {
-    int w;
-    int h;
-    int comp;
-    unsigned char *image = stbi_load(img_file.c_str(), &w, &h, &comp, STBI_rgb);
-
-    // if (comp!=3) // STBI_rgb should ensure this?
-    //     cout << "Warning: Expecting an RGB image (3 channels, got " << comp
-    //     <<")\n"; // may well crash if fewer or load wrong if greater?
-
-    SynchronisedArray<Pixel> img(ecl.context, CL_MEM_READ_ONLY, {w, h});
-    for (int i = 0; i < w; i++) {
-      for (int j = 0; j < h; j++) {
-        int k = j * w + i;
-        img[i, j] = {image[3 * k], image[3 * k + 1], image[3 * k + 2]}; // <--
-      }
-    }
-
-    SynchronisedArray<ImDims> dims(ecl.context, CL_MEM_READ_ONLY);
-    dims[0] = {w, h};
-
-    ecl.apply_kernel("map_img2", *field1, *field2, img, *pix, dims);
-
-    delete image;
-  }
-}
-
-void App::fields_to_RGB(bool norm = false) {
-  string kernel = norm ? "pack_norm" : "pack";
-  ecl.apply_kernel(kernel, *field1, *field2, *field3, *pix);
-}
-
-void App::compute_join() { ecl.queue.finish(); }
-
 void App::render() {
   // ImGui::ShowDemoWindow();
 
-  compute_join(); // should probably be outside of rendering code, but would
-                  // come immediately before and after anyway, so keeping inside
-                  // own scripts (main is from imgui examples)
+  collect_frames(); // should probably be outside of rendering code, but would
+                    // come immediately before and after anyway, so keeping
+                    // inside own scripts (main is from imgui examples)
+  if (ecl.profiling)
+    record_profile();
+  poll_compile(); // swapping in new kernels between frames
+  scale_resolution();
 
   show_viewport();
+  auto start = chrono::steady_clock::now();
   controlls_tab(); // queing gpu jobs in here
+  chrono::duration<float, milli> took = chrono::steady_clock::now() - start;
+  host_ms = 0.9 * host_ms + 0.1 * took.count();
+  submit_frame(); // displayed by a later frame, once done
 }
 
-void App::reset_view() {
-  if (mandel) {
-    viewport_center = {-0.75, 0};
-    viewport_deltas = {1.25, 1.25};
-  } else {
-    viewport_center = {0, 0};
-    viewport_deltas = {2, 2};
+void App::scale_resolution()
+// between frames, before any jobs are queued at the new size
+{
+  frames_at_size++;
+  if (auto_resolution && compute_ms > 0 && frames_at_size >= 10) {
+    // compute time goes with the pixel count, small errors are left alone
+    float ideal = render_scale * sqrt(target_ms / compute_ms);
+    if (ideal < 0.9 * render_scale || ideal > 1.1 * render_scale)
+      render_scale = clamp(ideal, render_scale / 2, render_scale * 1.25f);
+  }
+  render_scale = clamp(render_scale, min_scale, max_scale);
+
+  // multiples of 8 suit the work-group shapes
+  int n = max(8, (int)round(display_N * render_scale / 8) * 8);
+  int m = max(8, (int)round(display_M * render_scale / 8) * 8);
+  if (n != N || m != M) {
+    resize(n, m);
+    frames_at_size = 0;
+    compute_ms = 0; // measured again at the new size
   }
 }
 
 void App::show_viewport() {
-  viewport.set(pix->cpu_buff, M, N);
+  if (has_frame()) // else keeping the last one, e.g. of the old size
+    viewport.set(frame_pixels(), M, N);
 
   ImGui::Begin("Viewport");
 
   ImGuiIO &io = ImGui::GetIO();
 
-  // Pan
-  float deltaX = 0, deltaY = 0;
+  // Pan, by whole pixels so that the computed fields can be shifted and reused
+  static float remX = 0, remY = 0;
   if (ImGui::IsWindowHovered() && ImGui::IsMousePosValid() &&
       ImGui::IsMouseDown(1)) {
-    deltaX = 2 * io.MouseDelta.x / (float)N;
-    deltaY = 2 * io.MouseDelta.y / (float)M;
-    viewport_center.re -= viewport_deltas.re * deltaX;
-    viewport_center.im -= viewport_deltas.im * deltaY;
-    // ImGui::Text("Mouse delta (screen fraction): (%f, %f)", deltaX, deltaY);
+    remX += io.MouseDelta.x * M / display_M; // in rendered pixels
+    remY += io.MouseDelta.y * N / display_N;
+    int pixX = (int)remX, pixY = (int)remY;
+    remX -= pixX;
+    remY -= pixY;
+
+    FPN stepX = 2 * viewport_deltas.re / M, stepY = 2 * viewport_deltas.im / N;
+    viewport_center.re -= pixX * stepX;
+    viewport_center.im -= pixY * stepY;
+    deep.pan(-pixX * stepX, -pixY * stepY);
   }
 
   // Zoom
@@ -182,14 +102,28 @@ void App::show_viewport() {
 
   ImGui::Text("FPS %f (currently copying frames from OpenCL -> RAM -> OpenGL)",
               ImGui::GetIO().Framerate);
-  ImGui::Text("Center: (%lg) + (%lg)i", viewport_center.re, viewport_center.im);
+  ImGui::Text("Host time per frame: %.3f ms", host_ms);
+  if (backend == ComputeBackend::OpenCL)
+    ImGui::Text("Frame latency: %.1f ms, %.1f frames/s computed",
+                frame_latency_ms, frame_rate);
+  ImGui::Text("Render resolution: %d x %d, compute %.1f ms per frame", M, N,
+              compute_ms);
+  ImGui::Text("Early exits (interior detection): %d", early_exits);
+  ImGui::Text("Computed at: %s%s", precision_name(precision_used),
+              precision == Precision::Auto ? " (auto)" : "");
+  if (deep_zoom || use_df())
+    ImGui::Text("Center: %s", deep.center_str().c_str());
+  else
+    ImGui::Text("Center: (%lg) + (%lg)i", viewport_center.re,
+                viewport_center.im);
   ImGui::Text("Box dims: (%lg) x (%lg)", 2 * viewport_deltas.re,
               2 * viewport_deltas.im);
 
   if (ImGui::Button("Reset view"))
     reset_view();
 
-  ImGui::Image((void *)(intptr_t)viewport.tex_id, ImVec2(M, N));
+  ImGui::Image((void *)(intptr_t)viewport.tex_id,
+               ImVec2(display_M, display_N));
 
   ImGui::End();
 }
@@ -200,6 +134,75 @@ void App::controlls_tab() {
   if (ImGui::Button("Toggle compute active"))
     compute_enabled = !compute_enabled;
 
+  ImGui::Text("Backend:");
+  if (ecl.available) {
+    ImGui::RadioButton("OpenCL", &backend, ComputeBackend::OpenCL);
+    ImGui::SameLine();
+  }
+  ImGui::RadioButton("CPU threads", &backend, ComputeBackend::CPU);
+  if (backend == ComputeBackend::CPU) {
+    ImGui::Text("(%d threads, recursed function edits only apply to OpenCL)",
+                cpu.pool.n_threads);
+    for (int isa = SimdIsa::Scalar; isa <= cpu.simd_supported; isa++) {
+      ImGui::SameLine();
+      ImGui::RadioButton(simd_name(isa), &cpu.simd, isa);
+    }
+  }
+
+  ImGui::Checkbox("Auto resolution", &auto_resolution);
+  ImGui::SameLine();
+  if (auto_resolution)
+    ImGui::SliderFloat("Target compute ms", &target_ms, 4, 100);
+  else
+    ImGui::SliderFloat("Resolution scale", &render_scale, min_scale,
+                       max_scale);
+
+  ImGui::Checkbox("Reuse fields (skip unchanged, shift on pan)",
+                  &reuse_fields);
+  if (backend == ComputeBackend::OpenCL) {
+    ImGui::Checkbox("Progressive (1/8 to full resolution over 4 frames)",
+                    &progressive);
+    if (progressive && computed[field1].step > 1) {
+      ImGui::SameLine();
+      ImGui::Text("1/%d", computed[field1].step);
+    }
+    ImGui::Checkbox("Mariani-Silver (fill uniform tiles of iters fields)",
+                    &subdivide);
+    ImGui::Checkbox("Fuse multi-field kernels (one orbit for all fields)",
+                    &fuse_fields);
+    ImGui::Checkbox("Specialize kernels (settings baked in as constants)",
+                    &specialize);
+    if (specialize) {
+      ImGui::SameLine();
+      ImGui::Text("%s", variant_used == "" ? "generic" : variant_used.c_str());
+    }
+    ImGui::SliderInt("Frames in flight", &frames_in_flight, 1,
+                     max_frames_in_flight);
+    if (ImGui::Button("Autotune work-groups (on this view)"))
+      autotune();
+    ImGui::SameLine();
+    ImGui::Text("%zu kernels tuned", ecl.local_shapes.size());
+    ImGui::Checkbox("All OpenCL devices (full fields split in row bands)",
+                    &multi_device);
+    if (multi_device && multi) {
+      for (auto &w : multi->workers) {
+        if (w.failed)
+          ImGui::Text("  %s: build failed", w.name.c_str());
+        else
+          ImGui::Text("  %s: %.1f Mpix/s, %d rows", w.name.c_str(),
+                      w.rate / 1e3, w.rows);
+      }
+    }
+  }
+
+  if (backend == ComputeBackend::OpenCL) {
+    bool profiling = ecl.profiling;
+    if (ImGui::Checkbox("Profile (OpenCL events)", &profiling))
+      ecl.set_profiling(profiling);
+    if (ecl.profiling)
+      show_profile();
+  }
+
   ImGui::Text("Inputs:");
   ImGui::Text("Pan: Right click and drag in viewport");
   ImGui::Text("Zoom: Mouse wheel");
@@ -208,19 +211,23 @@ void App::controlls_tab() {
   ImGui::SameLine();
   if (ImGui::Button("Reset")) {
     strcpy(func_buff, default_recurse_func.c_str());
-    compile_kernels(func_buff);
+    recompile = true;
+  }
+  if (compiling()) {
+    ImGui::SameLine();
+    ImGui::Text("Compiling...");
   }
 
   ImGui::InputTextMultiline("Recursed function:", &func_buff[0],
                             func_buff_size);
 
-  static bool success;
+  if (recompile && ecl.available)
+    compile_kernels_async(func_buff);
 
-  if (recompile)
-    success = compile_kernels(func_buff);
-
-  if (!success)
+  if (!build_ok) {
+    ImGui::Text("Build failed, still using the last working function:");
     ImGui::Text(ecl.cl_error.c_str());
+  }
 
   ImGui::Text("\nGeneral Params:");
 
@@ -237,61 +244,85 @@ void App::controlls_tab() {
   MAXITER = pow(10, MAXITERpow);
   ImGui::Text("MAXITER: %d", MAXITER);
 
+  ImGui::Text("Interior detection:");
+  ImGui::CheckboxFlags("Cardioid/bulb test", &interior, INTERIOR_BULBS);
+  ImGui::SameLine();
+  ImGui::CheckboxFlags("Periodicity", &interior, INTERIOR_PERIOD);
+
+  if (ImGui::Checkbox("Deep zoom (perturbation, default function only)",
+                      &deep_zoom) &&
+      !deep_zoom) {
+    // back to what FPN can hold
+    viewport_center = {(FPN)deep.center_re.get_d(),
+                       (FPN)deep.center_im.get_d()};
+  }
+  if (deep_zoom)
+    ImGui::Text("Reference orbits: %d, unresolved glitches: %d",
+                deep.references, deep.glitched);
+  else if (viewport_deltas.re / M <
+           1e3 * numeric_limits<FPN>::epsilon() *
+               (abs(viewport_center.re) + abs(viewport_center.im)))
+    ImGui::Text("Pixel spacing is near FPN precision, try deep zoom");
+
+  ImGui::Text("Precision (default function only, else native):");
+  bool was_df = use_df();
+  ImGui::RadioButton("Native (FPN)", &precision, Precision::Native);
+  ImGui::SameLine();
+  ImGui::RadioButton("Double-float", &precision, Precision::DoubleFloat);
+  ImGui::SameLine();
+  ImGui::RadioButton("Float", &precision, Precision::Single);
+  ImGui::SameLine();
+  ImGui::RadioButton("Auto", &precision, Precision::Auto);
+  if (was_df && !use_df() && !deep_zoom)
+    viewport_center = {(FPN)deep.center_re.get_d(),
+                       (FPN)deep.center_im.get_d()};
+
   ImGui::Text("\nMode:");
   ImGui::RadioButton("Single field", &compute_mode, ComputeMode::SingleField);
   ImGui::RadioButton("Dual field - Image map", &compute_mode,
                      ComputeMode::DualField);
   ImGui::RadioButton("Tri field - RGB", &compute_mode, ComputeMode::TriField);
 
+  ImGui::Text("\nColormap input:");
+  ImGui::RadioButton("Field values", &tone, TONE_FIXED);
+  ImGui::SameLine();
+  ImGui::RadioButton("Auto range", &tone, TONE_RANGE);
+  ImGui::SameLine();
+  ImGui::RadioButton("Equalized", &tone, TONE_EQUALIZE);
+  if (tone == TONE_RANGE)
+    ImGui::SliderFloat("Clip at each end", &tone_clip, 0, 0.2);
+
   // Update general params
-  (*param)[0].mandel = mandel ? 1 : 0;
-  (*param)[0].c = {(FPN)cre, (FPN)cim};
-  (*param)[0].view_rect = {viewport_center.re - viewport_deltas.re,
-                           viewport_center.re + viewport_deltas.re,
-                           viewport_center.im - viewport_deltas.im,
-                           viewport_center.im + viewport_deltas.im};
-  (*param)[0].MAXITER = MAXITER;
+  update_params();
 
-  // start computing next frame // could interfere with subsequent OpenGL calls?
   switch (compute_mode) {
   case ComputeMode::SingleField: {
-    static FieldUIState state;
-    handle_field("Field", field1, &state);
+    handle_field("Field", &single_field);
 
-    static float f1 = 1;
-    static float f2 = 2;
-    static float f3 = 3;
     ImGui::Text("Cmap frequencies:");
-    ImGui::SliderFloat("f1", &f1, 0.01, 100); // make logarithmic?
-    ImGui::SliderFloat("f2", &f2, 0.01, 100);
-    ImGui::SliderFloat("f3", &f3, 0.01, 100);
-    map_sines(f1, f2, f3);
+    ImGui::SliderFloat("f1", &freqs[0], 0.01, 100); // make logarithmic?
+    ImGui::SliderFloat("f2", &freqs[1], 0.01, 100);
+    ImGui::SliderFloat("f3", &freqs[2], 0.01, 100);
     break;
   }
   case ComputeMode::DualField: {
-
-    static int file_idx = 0;
-    ImGui::Combo("Mimg", &file_idx, migs_opts.c_str());
-
-    static FieldUIState stateU;
-    handle_field("U Field", field1, &stateU);
-    static FieldUIState stateV;
-    handle_field("V Field", field2, &stateV);
-
-    map_img(mimgs[file_idx]);
+    ImGui::Combo("Mimg", &image_idx, migs_opts.c_str());
+    if (ImGui::Checkbox("Keep raw copies (mimg/.raw, mapped on reload)",
+                        &keep_raw))
+      images.raw_dir = keep_raw ? "mimg/.raw" : "";
+    ImGui::Text("Image cache: %.1f MB%s", images.bytes() / 1e6,
+                images.pending(frame_image()) ? ", decoding..." : "");
+
+    handle_field("U Field", &dual_fields[0]);
+    handle_field("V Field", &dual_fields[1]);
     break;
   }
   case ComputeMode::TriField: {
-    static FieldUIState stateR;
-    handle_field("R Field", field1, &stateR);
-    static FieldUIState stateG;
-    handle_field("G Field", field2, &stateG);
-    static FieldUIState stateB;
-    handle_field("B Field", field3, &stateB);
-
-    static bool nc = false;
-    ImGui::Checkbox("Normalise colors", &nc);
-    fields_to_RGB(nc);
+    handle_field("R Field", &tri_fields[0]);
+    handle_field("G Field", &tri_fields[1]);
+    handle_field("B Field", &tri_fields[2]);
+
+    ImGui::Checkbox("Normalise colors", &norm_colors);
     break;
   }
   default:
@@ -299,24 +330,166 @@ void App::controlls_tab() {
     break;
   }
 
+  // start computing next frame // could interfere with subsequent OpenGL calls?
+  SessionFrame frame = frame_state();
+  queue_frame(*this, frame, frame_image());
+  if (recorder.recording())
+    recorder.frame(frame, installed_func, frame_image(), center_record(deep));
+
+  session_controlls(frame);
+
   ImGui::End();
 }
 
-void App::handle_field(string field_name, SynchronisedArray<FPN> *field,
-                       FieldUIState *state) {
+SessionFrame App::frame_state() {
+  SessionFrame f = session_frame(*this, compute_mode);
+  switch (compute_mode) {
+  case ComputeMode::SingleField:
+    f.fields[0] = single_field;
+    break;
+  case ComputeMode::DualField:
+    copy(dual_fields, dual_fields + 2, f.fields);
+    break;
+  case ComputeMode::TriField:
+    copy(tri_fields, tri_fields + 3, f.fields);
+    break;
+  }
+  f.freqs = {freqs[0], freqs[1], freqs[2]};
+  f.norm = norm_colors;
+  return f;
+}
+
+string App::frame_image() {
+  return image_idx < (int)mimgs.size() ? mimgs[image_idx] : "";
+}
+
+void App::session_controlls(const SessionFrame &frame) {
+  ImGui::Text("\nSession (replay with fractalcli --replay file):");
+  ImGui::InputText("Log file", session_path, sizeof(session_path));
+  if (recorder.recording()) {
+    if (ImGui::Button("Stop recording"))
+      recorder.close();
+    ImGui::SameLine();
+    ImGui::Text("%d frames, %.1f kB", recorder.frames, recorder.bytes / 1e3);
+  } else {
+    if (ImGui::Button("Record"))
+      session_msg = recorder.open(session_path)
+                        ? ""
+                        : "Cannot write " + string(session_path);
+    ImGui::SameLine();
+    if (ImGui::Button("Save params")) {
+      SessionRecorder params;
+      if (params.open(session_path)) {
+        params.frame(frame, installed_func, frame_image(),
+                     center_record(deep));
+        session_msg = "Saved " + string(session_path);
+      } else {
+        session_msg = "Cannot write " + string(session_path);
+      }
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Load params"))
+      load_params(session_path);
+  }
+  if (session_msg != "")
+    ImGui::Text("%s", session_msg.c_str());
+}
+
+void App::load_params(string path) {
+  try {
+    SessionReader reader(path);
+    SessionFrame f;
+    while (reader.next(f))
+      ;
+    if (reader.frames == 0)
+      throw runtime_error(path + " has no frames");
+
+    f.param.dims = {N, M};
+    // the function is built in the background, as from the editor
+    apply_frame(*this, f, installed_func, reader.center);
+    compute_mode = f.compute_mode;
+    single_field = f.fields[0];
+    copy(f.fields, f.fields + 2, dual_fields);
+    copy(f.fields, f.fields + 3, tri_fields);
+    freqs[0] = f.freqs.f1;
+    freqs[1] = f.freqs.f2;
+    freqs[2] = f.freqs.f3;
+    norm_colors = f.norm;
+    auto image = find(mimgs.begin(), mimgs.end(), reader.image);
+    if (image != mimgs.end())
+      image_idx = image - mimgs.begin();
+    MAXITERpow = log10(MAXITER + 0.5); // truncated back to MAXITER
+
+    string func = reader.func == "" ? default_recurse_func : reader.func;
+    strncpy(func_buff, func.c_str(), func_buff_size - 1);
+    func_buff[func_buff_size - 1] = '\0';
+    if (ecl.available && reader.func != installed_func)
+      compile_kernels_async(func_buff);
+    session_msg = "Loaded " + path;
+  } catch (exception &e) {
+    session_msg = e.what();
+  }
+}
+
+void App::record_profile()
+// called once the last frame's jobs are done
+{
+  float totals[3] = {0, 0, 0};
+  for (auto &record : ecl.profile) {
+    if (record.frame == ecl.profile_frame)
+      totals[record.stage] += (record.end - record.start) / 1e6;
+  }
+  for (int stage = 0; stage < 3; stage++)
+    stage_ms[stage][profile_offset] = totals[stage];
+  profile_offset = (profile_offset + 1) % profile_frames;
+
+  ecl.profile_frame++;
+}
+
+void App::show_profile() {
+  const char *stages[] = {"upload", "compute", "download"};
+  int last = (profile_offset + profile_frames - 1) % profile_frames;
+
+  for (int stage = 0; stage < 3; stage++) {
+    string label = string(stages[stage]) + " ms";
+    string overlay = to_string(stage_ms[stage][last]);
+    ImGui::PlotLines(label.c_str(), stage_ms[stage], profile_frames,
+                     profile_offset, overlay.c_str(), 0);
+  }
+
+  if (ImGui::TreeNode("Last frame")) {
+    for (auto &record : ecl.profile) {
+      if (record.frame == ecl.profile_frame - 1)
+        ImGui::Text("%-8s %-24s %8.3f ms", stages[record.stage],
+                    record.name.c_str(), (record.end - record.start) / 1e6);
+    }
+    ImGui::TreePop();
+  }
+
+  static string dumped = "";
+  if (ImGui::Button("Dump trace")) {
+    ecl.dump_trace("trace.json");
+    dumped = "Wrote trace.json (load in chrome://tracing or Perfetto)";
+  }
+  if (dumped != "") {
+    ImGui::SameLine();
+    ImGui::Text("%s", dumped.c_str());
+  }
+}
+
+void App::handle_field(string field_name, FieldUIState *state)
+// controlls for the field
+{
   ImGui::Combo(field_name.c_str(), &state->field,
                "Iters\0Proximity\0Orbit trap\0\0");
 
   switch (state->field) {
   case 0:
-    escape_iter(field);
     break;
   case 1: {
     string fn = field_name + " PROXTYPE"; // sliders seem to get linked if they
                                           // do not have unique names
     ImGui::SliderInt(fn.c_str(), &state->proxtype, 1, 7);
-
-    min_prox(field, state->proxtype);
     break;
   }
   case 2: {
@@ -329,9 +502,6 @@ void App::handle_field(string field_name, SynchronisedArray<FPN> *field,
     ImGui::SliderFloat("trap top", &state->box_top, -2, 2);
     ImGui::SliderFloat("trap left", &state->box_left, -2, 2);
     ImGui::SliderFloat("trap right", &state->box_right, -2, 2);
-
-    orbit_trap(field, state->box_bot, state->box_top, state->box_left,
-               state->box_right, state->real);
     break;
   }
   default:
@@ -7,7 +7,8 @@
 // using namespace std::chrono;
 
 #include "../mandelstructs.h"
-#include "easy_cl.hpp"
+#include "fractal_compute.hpp"
+#include "session.hpp"
 
 using namespace std;
 
@@ -46,73 +47,60 @@ public:
   }
 };
 
-enum ComputeMode { SingleField = 0, DualField = 1, TriField = 2 };
-
-struct FieldUIState {
-  int field = 0;
-  int proxtype = 1;
-  bool real = false;
-  // unfortunately cannot just use Box struct, since imgui sliders work on float
-  float box_bot = 0;
-  float box_top = 0.5;
-  float box_left = 0;
-  float box_right = 0.5;
-};
-
-class App {
+class App : public FractalCompute {
 public:
-  int N;
-  int M;
   static string title;
   vector<string> mimgs;
   string migs_opts = "";
 
   Texture viewport;
+  // shown at display_M x display_N, rendered at render_scale times that and
+  // stretched by the texture's filtering. Auto scales to hold target_ms of
+  // compute per frame
+  const static int display_N = 600, display_M = 800;
+  float render_scale = 1;
+  const float min_scale = 0.25, max_scale = 2;
+  bool auto_resolution = false;
+  float target_ms = 16;
+  int frames_at_size = 0;
 
-  EasyCL ecl;
-
-  SynchronisedArray<FPN> *field1;
-  SynchronisedArray<FPN> *field2;
-  SynchronisedArray<FPN> *field3;
-
-  SynchronisedArray<FParam> *param;
-  SynchronisedArray<Pixel> *pix;
-
-  Complex viewport_center = {-0.75, 0};
-  Complex viewport_deltas = {1.25, 1.25};
-  int MAXITER = 100;
   int compute_mode = ComputeMode::SingleField;
-  float MAXITERpow = 2, cre = -0.85, cim = 0.6;
-  bool mandel = true;
-
-  bool compute_enabled = false;
-
-  string default_recurse_func = "inline Complex_t f(Complex_t z, Complex_t c)\n\
-{\n\
-    return complex_add(complex_pow(z, 2), c);\n\
-}";
+  // per mode field settings and colormap params, which the frame's jobs
+  // depend on besides the FractalCompute state (see SessionFrame)
+  FieldUIState single_field, dual_fields[2], tri_fields[3];
+  float freqs[3] = {1, 2, 3};
+  int image_idx = 0;
+  bool keep_raw = false;
+  bool norm_colors = false;
+
+  // recording of every frame for fractalcli --replay, and parameter sets,
+  // which are one frame logs
+  SessionRecorder recorder;
+  char session_path[256] = "session.bin";
+  string session_msg = "";
+  float host_ms = 0; // spent in controlls_tab, i.e. UI and queueing jobs
+  float MAXITERpow = 2;
 
   const static size_t func_buff_size = 512;
   char func_buff[func_buff_size];
 
+  // per stage totals (ms) of the last frames, from the OpenCL events
+  const static int profile_frames = 120;
+  float stage_ms[3][profile_frames] = {};
+  int profile_offset = 0;
+
   App();
-  ~App();
-
-  // gpu jobs
-  void min_prox(SynchronisedArray<FPN> *prox, int PROXTYPE);
-  void escape_iter(SynchronisedArray<FPN> *prox);
-  void orbit_trap(SynchronisedArray<FPN> *prox, float bb, float bt, float bl,
-                  float br, bool real);
-  void map_sines(FPN f1, FPN f2, FPN f3);
-  void map_img(string img_file);
-  void fields_to_RGB(bool normalise);
-
-  void compute_join();
-  bool compile_kernels(string new_func);
+
   void render();
-  void reset_view();
+  void scale_resolution();
   void show_viewport();
   void controlls_tab();
-  void handle_field(string field_name, SynchronisedArray<FPN> *prox,
-                    FieldUIState *state);
+  void record_profile();
+  void show_profile();
+  void handle_field(string field_name, FieldUIState *state);
+  SessionFrame frame_state();
+  string frame_image();
+  void session_controlls(const SessionFrame &frame);
+  // of the last frame of a log, but for the resolution
+  void load_params(string path);
 };
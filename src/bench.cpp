@@ -0,0 +1,388 @@
+// Kernel benchmark, runs every kernel in mandel.cl over a fixed catalogue of
+// views and sweeps over MAXITER and resolution, reporting the medians as JSON.
+// Build with and without USE_FLOAT (make bench builds both) to compare.
+//
+//   fractalbench [--maxiter 100,1000,10000] [--sizes 800x600,1920x1080]
+//                [--reps 5] [--interior 3] [--out bench.json]
+//
+// --interior takes the INTERIOR_* bits (0 to time the full iteration).
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <sstream>
+
+#include "fractal_compute.hpp"
+
+struct View {
+  string name;
+  Complex center;
+  FPN width;
+  bool mandel;
+  Complex c; // julia constant
+};
+
+static const vector<View> views = {
+    {"full", {-0.75, 0}, 3.5, true, {0, 0}},
+    {"seahorse", {-0.7453, 0.1127}, 0.0065, true, {0, 0}},
+    {"interior", {-0.2, 0}, 0.2, true, {0, 0}}, // all in the main cardioid
+    {"julia", {0, 0}, 3.2, false, {-0.8, 0.156}},
+};
+
+struct Timing {
+  double upload = 0;   // ms
+  double compute = 0;  // ms
+  double download = 0; // ms
+};
+
+typedef chrono::steady_clock Clock;
+
+static double ms_since(Clock::time_point &t) {
+  Clock::time_point now = Clock::now();
+  double ms = chrono::duration<double, milli>(now - t).count();
+  t = now;
+  return ms;
+}
+
+template <typename T> void force_upload(T &arg) {
+  if constexpr (is_base_of_v<AbstractSynchronisedArray, T>)
+    arg.mark_host_dirty();
+}
+
+// apply_kernel split into its stages, finishing the queue after each. Every
+// input array is uploaded and the result (first_arr) read back, regardless of
+// what the residency tracking would skip
+template <typename... Args>
+Timing timed_kernel(EasyCL &ecl, string kernel_name,
+                    AbstractSynchronisedArray &first_arr, Args &...args) {
+  Timing timing;
+  first_arr.mark_host_dirty();
+  (force_upload(args), ...);
+  Clock::time_point t = Clock::now();
+
+  ecl.set_args(kernel_name, first_arr, args...);
+  ecl.queue.finish();
+  timing.upload = ms_since(t);
+
+  ecl.queue.enqueueNDRangeKernel(ecl.get_kernel(kernel_name), cl::NullRange,
+                                 cl::NDRange(first_arr.dims.x, first_arr.dims.y),
+                                 cl::NullRange);
+  ecl.queue.finish();
+  timing.compute = ms_since(t);
+
+  first_arr.mark_device_dirty();
+  first_arr.from_gpu(ecl.queue);
+  ecl.queue.finish();
+  timing.download = ms_since(t);
+
+  return timing;
+}
+
+static double median(vector<double> v) {
+  sort(v.begin(), v.end());
+  return v[v.size() / 2];
+}
+
+static Timing median_timing(function<Timing()> run, int reps) {
+  run(); // warm up
+  vector<double> up, comp, down;
+  for (int r = 0; r < reps; r++) {
+    Timing t = run();
+    up.push_back(t.upload);
+    comp.push_back(t.compute);
+    down.push_back(t.download);
+  }
+  return {median(up), median(comp), median(down)};
+}
+
+static void bench_view(FractalCompute &fc, const View &view, int W, int H,
+                       int maxiter, int reps, ostream &out, bool &first) {
+  EasyCL &ecl = fc.ecl;
+  fc.resize(H, W);
+  fc.MAXITER = maxiter;
+  fc.mandel = view.mandel;
+  fc.viewport_center = view.center;
+  fc.viewport_deltas = {view.width / 2, view.width / 2 * H / W};
+  fc.update_params();
+  (*fc.param)[0].c = view.c;
+
+  // reference orbit for the perturbation kernels, first pass only
+  fc.deep.set_center(view.center.re, view.center.im);
+  fc.deep.reference((*fc.param)[0], fc.viewport_deltas, H, W);
+  delete fc.ref_orbit;
+  fc.ref_orbit = new SynchronisedArray<Complex>(ecl.context, CL_MEM_READ_ONLY,
+                                                {(int)fc.deep.orbit.size()});
+  copy(fc.deep.orbit.begin(), fc.deep.orbit.end(), fc.ref_orbit->cpu_buff);
+  (*fc.deep_param)[0] = fc.deep.pixel_map(fc.viewport_deltas, H, W);
+  (*fc.deep_param)[0].pass = 0;
+
+  SynchronisedArray<int> iters(ecl.context, {H, W});
+  SynchronisedArray<Complex> uv(ecl.context, {H, W});
+
+  int pt = 7;
+  Box box = {0, 0.5, 0, 0.5};
+  Freqs freqs = {1, 2, 3};
+
+  // gradient in place of a sample image
+  int imW = 256, imH = 256;
+  SynchronisedArray<Pixel> img(ecl.context, CL_MEM_READ_ONLY, {imH, imW});
+  for (int i = 0; i < imH; i++) {
+    for (int j = 0; j < imW; j++)
+      img[i, j] = {(unsigned char)i, (unsigned char)j, 128};
+  }
+  ImDims dims = {imH, imW};
+
+  // iterations per pixel of the escape_iter, min_prox and orbit_trap loops,
+  // which stop on different conditions, counted on the host for the work of
+  // each kernel. First with the interior detection, then without it as in the
+  // perturbation kernels (their glitch stops aside), and last for the trap of
+  // the fused kernels, which run as many as the longest of their fields. The
+  // double-float kernels take the same orbits
+  FParam_t plain = (*fc.param)[0];
+  plain.interior = 0;
+  vector<vector<int>> counts(7, vector<int>(W * H));
+  for (int k = 0; k < 6; k++)
+    fc.cpu.iterations(counts[k].data(), k < 3 ? (*fc.param)[0] : plain, k % 3,
+                      box, H, W);
+  auto total_iters = [&](vector<int> loops) {
+    double total = 0;
+    for (int p = 0; p < W * H; p++) {
+      int n = 0;
+      for (int k : loops)
+        n = max(n, counts[k][p]);
+      total += n;
+    }
+    return total;
+  };
+  double escape_n = total_iters({0}), prox_n = total_iters({1}),
+         trap_n = total_iters({2});
+  double escape_pert_n = total_iters({3}), prox_pert_n = total_iters({4}),
+         trap_pert_n = total_iters({5});
+
+  SynchronisedArray<FPN> &f1 = *fc.field1, &f2 = *fc.field2, &f3 = *fc.field3;
+  SynchronisedArray<FParam> &param = *fc.param;
+  SynchronisedArray<DeepParam> &deep = *fc.deep_param;
+  SynchronisedArray<Complex> &ref = *fc.ref_orbit;
+  SynchronisedArray<int> &glitch = *fc.glitch;
+  SynchronisedArray<int> &early = *fc.early;
+  SynchronisedArray<FieldStats> &stats = *fc.stats;
+  SynchronisedArray<float> &cdf = *fc.cdf;
+  int eq = TONE_EQUALIZE, no_norm = 0;
+  DFParam_t df_view = fc.deep.df_map((*fc.param)[0], fc.viewport_deltas, H, W);
+
+  // name, iterations (0 if it does not iterate), run
+  vector<tuple<string, double, function<Timing()>>> kernels = {
+      {"escape_iter", escape_n,
+       [&] { return timed_kernel(ecl, "escape_iter", iters, param, early); }},
+      {"escape_iter_fpn", escape_n,
+       [&] {
+         return timed_kernel(ecl, "escape_iter_fpn", f1, param, early);
+       }},
+      {"escape_iter_df", escape_n,
+       [&] {
+         return timed_kernel(ecl, "escape_iter_df", f1, param, early, df_view);
+       }},
+      {"escape_iter_ms", 0, // whole Mariani-Silver sequence of kernels
+       [&] {
+         Clock::time_point t = Clock::now();
+         fc.mariani_silver(&f1);
+         ecl.queue.finish();
+         return Timing{0, ms_since(t), 0};
+       }},
+      {"min_prox", prox_n,
+       [&] { return timed_kernel(ecl, "min_prox", f1, param, early, pt); }},
+      {"orbit_trap", trap_n,
+       [&] {
+         return timed_kernel(ecl, "orbit_trap", uv, param, early, box);
+       }},
+      {"orbit_trap_re", trap_n,
+       [&] {
+         return timed_kernel(ecl, "orbit_trap_re", f1, param, early, box);
+       }},
+      {"orbit_trap_im", trap_n,
+       [&] {
+         return timed_kernel(ecl, "orbit_trap_im", f2, param, early, box);
+       }},
+      {"escape_iter_pert", escape_pert_n,
+       [&] {
+         return timed_kernel(ecl, "escape_iter_pert", f1, param, deep, ref,
+                             glitch);
+       }},
+      {"min_prox_pert", prox_pert_n,
+       [&] {
+         return timed_kernel(ecl, "min_prox_pert", f1, param, deep, ref,
+                             glitch, pt);
+       }},
+      {"orbit_trap_pert_re", trap_pert_n,
+       [&] {
+         return timed_kernel(ecl, "orbit_trap_pert_re", f1, param, deep, ref,
+                             glitch, box);
+       }},
+      {"orbit_trap_pert_im", trap_pert_n,
+       [&] {
+         return timed_kernel(ecl, "orbit_trap_pert_im", f2, param, deep, ref,
+                             glitch, box);
+       }},
+      {"map_sines", 0,
+       [&] { return timed_kernel(ecl, "map_sines", f1, *fc.pix, freqs); }},
+      {"map_img", 0,
+       [&] { return timed_kernel(ecl, "map_img", uv, img, *fc.pix, dims); }},
+      {"map_img2", 0,
+       [&] {
+         return timed_kernel(ecl, "map_img2", f1, f2, img, *fc.pix, dims);
+       }},
+      {"pack", 0,
+       [&] { return timed_kernel(ecl, "pack", f1, f2, f3, *fc.pix); }},
+      {"pack_norm", 0,
+       [&] { return timed_kernel(ecl, "pack_norm", f1, f2, f3, *fc.pix); }},
+      {"field_stats", 0,
+       [&] { // reduction and histogram, which the _tone kernels then use
+         Timing t;
+         ecl.queue.finish();
+         Clock::time_point start = Clock::now();
+         fc.field_stats(&f1, 0);
+         ecl.queue.finish();
+         t.compute = ms_since(start);
+         return t;
+       }},
+      {"map_sines_tone", 0,
+       [&] {
+         return timed_kernel(ecl, "map_sines_tone", f1, *fc.pix, freqs,
+                             stats, cdf, eq);
+       }},
+      {"pack_tone", 0,
+       [&] {
+         return timed_kernel(ecl, "pack_tone", f1, f2, f3, *fc.pix, stats, cdf,
+                             eq, no_norm);
+       }},
+      {"apply_log_int", 0,
+       [&] { return timed_kernel(ecl, "apply_log_int", iters); }},
+      {"apply_log_fpn", 0,
+       [&] { return timed_kernel(ecl, "apply_log_fpn", f3); }},
+  };
+
+  // iters, prox and trap fields in one, and a U/V trap pair sharing its box,
+  // to compare with the separate kernels and pack/map_img2 above
+  FieldUIState iters_f, prox_f, re_f, im_f;
+  prox_f.field = 1;
+  prox_f.proxtype = pt;
+  re_f.field = im_f.field = 2;
+  re_f.real = true;
+  Box trap = {re_f.box_bot, re_f.box_top, re_f.box_left, re_f.box_right};
+  fc.cpu.iterations(counts[6].data(), (*fc.param)[0], 2, trap, H, W);
+  string tri = fc.fused_kernel({&iters_f, &prox_f, &re_f}, "pack");
+  string uv_pair = fc.fused_kernel({&re_f, &im_f}, "map_img2");
+  if (tri != "") {
+    kernels.push_back({"fused_tri_pack", total_iters({0, 1, 6}), [&] {
+                         return timed_kernel(ecl, tri, f1, f2, f3, param,
+                                             early, pt, pt, pt, trap, trap,
+                                             trap, *fc.pix, *fc.pix, dims);
+                       }});
+  }
+  if (uv_pair != "") {
+    kernels.push_back({"fused_uv_map_img2", total_iters({6}), [&] {
+                         return timed_kernel(ecl, uv_pair, f1, f2, f3, param,
+                                             early, pt, pt, pt, trap, trap,
+                                             trap, img, *fc.pix, dims);
+                       }});
+  }
+
+  for (auto &[name, iterations, run] : kernels) {
+    Timing t = median_timing(run, reps);
+    double mpix = W * H / (t.compute * 1e3);
+
+    out << (first ? "\n" : ",\n");
+    first = false;
+    out << "    {\"view\": \"" << view.name << "\", \"kernel\": \"" << name
+        << "\", \"width\": " << W << ", \"height\": " << H
+        << ", \"maxiter\": " << maxiter << ", \"upload_ms\": " << t.upload
+        << ", \"compute_ms\": " << t.compute
+        << ", \"download_ms\": " << t.download
+        << ", \"mpix_per_s\": " << mpix << ", \"giter_per_s\": ";
+    if (iterations > 0)
+      out << iterations / (t.compute * 1e6);
+    else
+      out << "null";
+    out << "}";
+  }
+}
+
+static vector<int> parse_list(string s) {
+  vector<int> res;
+  stringstream ss(s);
+  string part;
+  while (getline(ss, part, ','))
+    res.push_back(stoi(part));
+  return res;
+}
+
+int main(int argc, char **argv) {
+  vector<int> maxiters = {100, 1000, 10000};
+  vector<pair<int, int>> sizes = {{800, 600}, {1920, 1080}};
+  int reps = 5;
+  int interior = INTERIOR_BULBS | INTERIOR_PERIOD;
+  string out_file = "";
+
+  for (int i = 1; i + 1 < argc; i += 2) {
+    string arg = argv[i];
+    if (arg == "--maxiter") {
+      maxiters = parse_list(argv[i + 1]);
+    } else if (arg == "--sizes") {
+      sizes.clear();
+      stringstream ss(argv[i + 1]);
+      string wh;
+      while (getline(ss, wh, ',')) {
+        size_t x = wh.find('x');
+        sizes.push_back({stoi(wh.substr(0, x)), stoi(wh.substr(x + 1))});
+      }
+    } else if (arg == "--reps") {
+      reps = max(1, stoi(argv[i + 1]));
+    } else if (arg == "--interior") {
+      interior = stoi(argv[i + 1]);
+    } else if (arg == "--out") {
+      out_file = argv[i + 1];
+    } else {
+      cerr << "Unknown option " << arg << "\n";
+      return 1;
+    }
+  }
+
+  FractalCompute fc(sizes[0].second, sizes[0].first);
+  if (!fc.ecl.available) {
+    cerr << "No OpenCL device to benchmark\n";
+    return 1;
+  }
+  fc.interior = interior;
+
+  stringstream out;
+  out << "{\n  \"device\": \""
+      << fc.ecl.device.getInfo<CL_DEVICE_NAME>() << "\",\n  \"driver\": \""
+      << fc.ecl.device.getInfo<CL_DRIVER_VERSION>() << "\",\n  \"fpn\": \""
+#ifdef USE_FLOAT
+      << "float"
+#else
+      << "double"
+#endif
+      << "\",\n  \"reps\": " << reps << ",\n  \"interior\": " << interior
+      << ",\n  \"results\": [";
+
+  bool first = true;
+  for (auto &[W, H] : sizes) {
+    for (int maxiter : maxiters) {
+      for (const View &view : views) {
+        cerr << view.name << " " << W << "x" << H << " maxiter " << maxiter
+             << "\n";
+        bench_view(fc, view, W, H, maxiter, reps, out, first);
+      }
+    }
+  }
+  out << "\n  ]\n}\n";
+
+  if (out_file != "") {
+    ofstream f(out_file);
+    f << out.str();
+  } else {
+    cout << out.str();
+  }
+  return 0;
+}
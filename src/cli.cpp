@@ -0,0 +1,395 @@
+// Headless batch renderer, no GLFW/ImGui. Jobs are given as key=value
+// arguments and/or as lines of a job file (values on a line override the ones
+// given on the command line). Kernels are compiled and buffers allocated once
+// for the whole batch, only being redone when the function or size changes.
+//
+//   fractalcli size=1920x1080 maxiter=1000 out=full.png
+//   fractalcli backend=cpu --jobs jobs.txt
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include "fractal_compute.hpp"
+#include "session.hpp"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+typedef map<string, string> Job;
+
+static const char *usage = "\
+usage: fractalcli [key=value ...] [--jobs file]\n\
+       fractalcli --replay session [--timings file.csv]\n\
+\n\
+  size=WxH          output resolution (default 800x600)\n\
+  center=re,im      view center, any number of digits when deep=1\n\
+  width=w           view width, height follows from the aspect ratio\n\
+  rect=l,r,b,t      view rect, instead of center and width\n\
+  maxiter=n         (default 100)\n\
+  julia=re,im       render the julia set for this constant\n\
+  mode=single|dual|tri\n\
+  field1=f, field2=f, field3=f\n\
+                    iters | prox:PROXTYPE | trap_re:b,t,l,r | trap_im:b,t,l,r\n\
+  freqs=f1,f2,f3    single field colormap (default 1,2,3)\n\
+  image=path        dual field sample image\n\
+  norm=0|1          tri field color normalisation\n\
+  tone=fixed|range|equalize\n\
+                    colormap input: the field values, their clip..1-clip\n\
+                    percentile range stretched to 0..1, or their rank\n\
+  clip=c            tone=range percentile cut at each end (default 0.01)\n\
+  func=path         file containing the recursed function\n\
+  backend=opencl|cpu\n\
+  deep=0|1          perturbation deep zoom\n\
+  precision=native|df|float|auto\n\
+                    df: double-float iters/prox/trap fields, for float only\n\
+                    devices, center as precise as with deep=1. float: float\n\
+                    fields in double builds. auto: picks from the pixel\n\
+                    spacing, float, then double or double-float\n\
+  subdivide=0|1     Mariani-Silver subdivision of iters fields (opencl)\n\
+  interior=n        interior detection bits, 1 bulbs, 2 periodicity (default 3)\n\
+  fuse=0|1          fused kernel for dual/tri mode fields (default 1)\n\
+  spec=0|1          settings baked into the kernels (default 1)\n\
+  tune=0|1          autotune work-group shapes on this job's view first, saved\n\
+                    per device in .clcache/workgroups.tsv\n\
+  devices=one|all   split fields over every OpenCL device (default one)\n\
+  cpu_split=n       with devices=all, CPU devices as sub-devices of n units\n\
+  out=path          .png, anything else is written as raw RGB bytes\n\
+\n\
+Each non empty line of a job file (# for comments) is one job.\n\
+\n\
+--replay renders every frame of a session recorded in the GUI, as fast as\n\
+possible, and reports the frame times, per frame with --timings. Kernel\n\
+builds (function changes, specialized variants) are timed apart.\n";
+
+static vector<string> split(const string &s, char sep) {
+  vector<string> parts;
+  stringstream ss(s);
+  string part;
+  while (getline(ss, part, sep))
+    parts.push_back(part);
+  return parts;
+}
+
+static void parse_tokens(const string &line, Job &job) {
+  stringstream ss(line);
+  string token;
+  while (ss >> token) {
+    size_t eq = token.find('=');
+    if (eq == string::npos)
+      throw runtime_error("Expected key=value, got " + token);
+    job[token.substr(0, eq)] = token.substr(eq + 1);
+  }
+}
+
+static vector<double> parse_numbers(const Job &job, string key, size_t count) {
+  vector<double> res;
+  for (auto &part : split(job.at(key), ','))
+    res.push_back(stod(part));
+  if (res.size() != count)
+    throw runtime_error(key + " expects " + to_string(count) + " values");
+  return res;
+}
+
+static FieldUIState parse_field(const string &spec) {
+  FieldUIState state;
+  vector<string> parts = split(spec, ':');
+  if (parts[0] == "iters") {
+    state.field = 0;
+  } else if (parts[0] == "prox") {
+    state.field = 1;
+    state.proxtype = parts.size() > 1 ? stoi(parts[1]) : 1;
+  } else if (parts[0] == "trap_re" || parts[0] == "trap_im") {
+    state.field = 2;
+    state.real = parts[0] == "trap_re";
+    if (parts.size() > 1) {
+      Job box = {{"trap", parts[1]}};
+      vector<double> b = parse_numbers(box, "trap", 4);
+      state.box_bot = b[0];
+      state.box_top = b[1];
+      state.box_left = b[2];
+      state.box_right = b[3];
+    }
+  } else {
+    throw runtime_error("Unknown field " + spec);
+  }
+  return state;
+}
+
+static string read_file(const string &path) {
+  ifstream input_stream(path, ios_base::binary);
+  if (input_stream.fail())
+    throw runtime_error("Failed to open " + path);
+  stringstream buffer;
+  buffer << input_stream.rdbuf();
+  return buffer.str();
+}
+
+static void render_job(FractalCompute &fc, Job &job, string &current_func) {
+  int W = 800, H = 600;
+  if (job.count("size")) {
+    vector<string> wh = split(job["size"], 'x');
+    if (wh.size() != 2)
+      throw runtime_error("size expects WxH");
+    W = stoi(wh[0]);
+    H = stoi(wh[1]);
+  }
+  fc.resize(H, W);
+
+  fc.backend =
+      fc.ecl.available ? ComputeBackend::OpenCL : ComputeBackend::CPU;
+  if (job.count("backend")) {
+    if (job["backend"] == "cpu")
+      fc.backend = ComputeBackend::CPU;
+    else if (job["backend"] == "opencl" && fc.ecl.available)
+      fc.backend = ComputeBackend::OpenCL;
+    else
+      throw runtime_error("Backend " + job["backend"] + " not available");
+  }
+
+  string func = job.count("func") ? read_file(job["func"]) : "";
+  if (func != current_func && fc.ecl.available) {
+    if (!fc.compile_kernels(func))
+      throw runtime_error("Kernel build failed:\n" + fc.ecl.cl_error);
+    current_func = func;
+  }
+
+  fc.MAXITER = job.count("maxiter") ? stoi(job["maxiter"]) : 100;
+  fc.mandel = !job.count("julia");
+  fc.reset_view();
+
+  // square pixels, unlike the GUI's fixed deltas
+  double width = fc.mandel ? 2.5 : 4;
+  if (job.count("width"))
+    width = stod(job["width"]);
+  fc.viewport_deltas = {(FPN)(width / 2), (FPN)(width / 2 * H / W)};
+
+  fc.deep_zoom = job.count("deep") && job["deep"] == "1";
+  fc.subdivide = job.count("subdivide") && job["subdivide"] == "1";
+  fc.fuse_fields = !job.count("fuse") || job["fuse"] == "1";
+  fc.specialize = !job.count("spec") || job["spec"] == "1";
+  fc.precision = Precision::Native;
+  if (job.count("precision")) {
+    map<string, int> precisions = {{"native", Precision::Native},
+                                   {"df", Precision::DoubleFloat},
+                                   {"float", Precision::Single},
+                                   {"auto", Precision::Auto}};
+    if (!precisions.count(job["precision"]))
+      throw runtime_error("Unknown precision " + job["precision"]);
+    fc.precision = precisions[job["precision"]];
+  }
+  fc.tone = TONE_FIXED;
+  if (job.count("tone")) {
+    map<string, int> tones = {{"fixed", TONE_FIXED},
+                              {"range", TONE_RANGE},
+                              {"equalize", TONE_EQUALIZE}};
+    if (!tones.count(job["tone"]))
+      throw runtime_error("Unknown tone " + job["tone"]);
+    fc.tone = tones[job["tone"]];
+  }
+  fc.tone_clip = job.count("clip") ? stof(job["clip"]) : 0.01;
+  fc.multi_device = job.count("devices") && job["devices"] == "all";
+  fc.cpu_split = job.count("cpu_split") ? stoi(job["cpu_split"]) : 0;
+  fc.interior = job.count("interior") ? stoi(job["interior"])
+                                      : INTERIOR_BULBS | INTERIOR_PERIOD;
+  if (job.count("center")) {
+    vector<string> c = split(job["center"], ',');
+    if (c.size() != 2)
+      throw runtime_error("center expects re,im");
+    fc.viewport_center = {(FPN)stod(c[0]), (FPN)stod(c[1])};
+    fc.deep.set_center(fc.viewport_center.re, fc.viewport_center.im);
+    if (fc.deep_zoom || fc.precision == Precision::DoubleFloat ||
+        fc.precision == Precision::Auto) {
+      mp_bitcnt_t prec = 4 * max(c[0].size(), c[1].size()) + 64;
+      fc.deep.center_re = mpf_class(c[0], prec);
+      fc.deep.center_im = mpf_class(c[1], prec);
+    }
+  }
+
+  if (job.count("rect")) {
+    vector<double> r = parse_numbers(job, "rect", 4);
+    fc.viewport_center = {(FPN)((r[0] + r[1]) / 2), (FPN)((r[2] + r[3]) / 2)};
+    fc.viewport_deltas = {(FPN)((r[1] - r[0]) / 2), (FPN)((r[3] - r[2]) / 2)};
+    fc.deep.set_center(fc.viewport_center.re, fc.viewport_center.im);
+  }
+
+  fc.update_params();
+  if (!fc.mandel) {
+    vector<double> c = parse_numbers(job, "julia", 2);
+    (*fc.param)[0].c = {(FPN)c[0], (FPN)c[1]};
+  }
+
+  if (job.count("tune") && job["tune"] == "1")
+    fc.autotune();
+
+  string mode = job.count("mode") ? job["mode"] : "single";
+  FieldUIState f1 = parse_field(job.count("field1") ? job["field1"] : "iters");
+  FieldUIState f2 = parse_field(job.count("field2") ? job["field2"] : "iters");
+  FieldUIState f3 = parse_field(job.count("field3") ? job["field3"] : "iters");
+
+  if (mode == "single") {
+    fc.compute_field(fc.field1, &f1);
+    vector<double> f = job.count("freqs") ? parse_numbers(job, "freqs", 3)
+                                          : vector<double>{1, 2, 3};
+    fc.map_sines(f[0], f[1], f[2]);
+  } else if (mode == "dual") {
+    if (!job.count("image"))
+      throw runtime_error("Dual field mode needs an image");
+    if (!fc.compute_fields({fc.field1, fc.field2}, {&f1, &f2}, "map_img2",
+                           job["image"]))
+      fc.map_img(job["image"]);
+  } else if (mode == "tri") {
+    bool norm = job.count("norm") && job["norm"] == "1";
+    if (!fc.compute_fields({fc.field1, fc.field2, fc.field3}, {&f1, &f2, &f3},
+                           norm ? "pack_norm" : "pack"))
+      fc.fields_to_RGB(norm);
+  } else {
+    throw runtime_error("Unknown mode " + mode);
+  }
+  fc.compute_join();
+  fc.read_frame();
+
+  string out = job.count("out") ? job["out"] : "out.png";
+  if (out.size() > 4 && out.substr(out.size() - 4) == ".png") {
+    if (!stbi_write_png(out.c_str(), W, H, 3, fc.pix->cpu_buff, 3 * W))
+      throw runtime_error("Failed to write " + out);
+  } else {
+    ofstream raw(out, ios_base::binary);
+    raw.write((char *)fc.pix->cpu_buff, sizeof(Pixel) * W * H);
+    if (raw.fail())
+      throw runtime_error("Failed to write " + out);
+  }
+}
+
+static int replay(string path, string timings_file) {
+  SessionReader session(path);
+  ofstream timings;
+  if (timings_file != "") {
+    timings.open(timings_file);
+    if (!timings)
+      throw runtime_error("Failed to open " + timings_file);
+    timings << "frame,ms,build_ms,width,height,mode,precision,early_exits\n";
+  }
+
+  // as the GUI, but waiting for images and kernel variants, so that replays
+  // of the same log render the same
+  FractalCompute fc(600, 800);
+  fc.compute_enabled = true;
+  fc.wait_for_images = true;
+  fc.wait_for_variants = true;
+
+  // the frame times leave out the kernel builds (function changes and
+  // variants), which are reported apart
+  vector<double> times;
+  double total_build = 0;
+  SessionFrame f;
+  while (session.next(f)) {
+    auto start = chrono::steady_clock::now();
+    double variant_wait = fc.variant_wait_ms;
+    apply_frame(fc, f, session.func, session.center);
+    auto applied = chrono::steady_clock::now();
+    queue_frame(fc, f, session.image);
+    fc.compute_join();
+    fc.read_frame();
+    auto end = chrono::steady_clock::now();
+
+    chrono::duration<double, milli> apply = applied - start;
+    chrono::duration<double, milli> took = end - applied;
+    double variant = fc.variant_wait_ms - variant_wait;
+    double build = apply.count() + variant;
+    double ms = max(took.count() - variant, 0.0);
+    total_build += build;
+
+    times.push_back(ms);
+    if (timings)
+      timings << times.size() - 1 << "," << ms << "," << build << "," << fc.M
+              << "," << fc.N << "," << f.compute_mode << ","
+              << precision_name(fc.precision_used) << "," << fc.early_exits
+              << "\n";
+  }
+  if (times.empty())
+    throw runtime_error(path + " has no frames");
+
+  double total = 0;
+  for (double t : times)
+    total += t;
+  sort(times.begin(), times.end());
+  cout << times.size() << " frames in " << total << " ms, median "
+       << times[times.size() / 2] << " ms, p95 "
+       << times[times.size() * 95 / 100] << " ms, max " << times.back()
+       << " ms, plus " << total_build << " ms of kernel builds\n";
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  Job base;
+  string job_file = "";
+  string replay_file = "", timings_file = "";
+
+  try {
+    for (int i = 1; i < argc; i++) {
+      string arg = argv[i];
+      if (arg == "-h" || arg == "--help") {
+        cout << usage;
+        return 0;
+      } else if (arg == "--jobs" && i + 1 < argc) {
+        job_file = argv[++i];
+      } else if (arg == "--replay" && i + 1 < argc) {
+        replay_file = argv[++i];
+      } else if (arg == "--timings" && i + 1 < argc) {
+        timings_file = argv[++i];
+      } else {
+        parse_tokens(arg, base);
+      }
+    }
+
+    if (replay_file != "")
+      return replay(replay_file, timings_file);
+
+    vector<Job> jobs;
+    if (job_file != "") {
+      stringstream lines(read_file(job_file));
+      string line;
+      while (getline(lines, line)) {
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") == string::npos)
+          continue;
+        Job job = base;
+        parse_tokens(line, job);
+        jobs.push_back(job);
+      }
+    } else {
+      jobs.push_back(base);
+    }
+
+    FractalCompute fc(600, 800);
+    fc.compute_enabled = true;
+    fc.wait_for_images = true;
+    fc.wait_for_variants = true;
+    string current_func = "";
+
+    int failed = 0;
+    for (size_t k = 0; k < jobs.size(); k++) {
+      auto start = chrono::steady_clock::now();
+      try {
+        render_job(fc, jobs[k], current_func);
+      } catch (exception &e) {
+        cerr << "job " << k << " failed: " << e.what() << "\n";
+        failed++;
+        continue;
+      }
+      chrono::duration<double, milli> took =
+          chrono::steady_clock::now() - start;
+      cout << "job " << k << ": " << fc.M << "x" << fc.N << " in "
+           << took.count() << " ms, " << fc.early_exits << " early exits, "
+           << precision_name(fc.precision_used) << "\n";
+    }
+    return failed ? 1 : 0;
+
+  } catch (exception &e) {
+    cerr << e.what() << "\n" << usage;
+    return 1;
+  }
+}
@@ -0,0 +1,488 @@
+#include <algorithm>
+#include <cmath>
+
+#include "cpu_backend.hpp"
+
+// mandelstructs.h is already included via cpu_backend.hpp
+#define EXTERNAL_CONCAT
+#include "../mandelutils.c"
+
+////////////////////////////////////////////////////////////////////////////
+//// Tile scheduler
+
+TileScheduler::TileScheduler(int threads) {
+  n_threads = threads > 0 ? threads
+                          : std::max(1, (int)std::thread::hardware_concurrency());
+
+  for (int w = 0; w < n_threads; w++)
+    queues.push_back(std::make_unique<WorkQueue>());
+
+  for (int w = 0; w < n_threads; w++)
+    this->threads.emplace_back(&TileScheduler::worker, this, w);
+}
+
+TileScheduler::~TileScheduler() {
+  {
+    std::lock_guard<std::mutex> lk(state_lock);
+    stopping = true;
+  }
+  start_cv.notify_all();
+  for (auto &t : threads)
+    t.join();
+}
+
+void TileScheduler::run(int N, int M, std::function<void(Tile)> job) {
+  std::vector<Tile> tiles;
+  for (int i0 = 0; i0 < N; i0 += tile_size) {
+    for (int j0 = 0; j0 < M; j0 += tile_size) {
+      tiles.push_back(
+          {i0, j0, std::min(i0 + tile_size, N), std::min(j0 + tile_size, M)});
+    }
+  }
+
+  // contiguous runs, so that expensive regions start out on few workers and
+  // have to be stolen from
+  int n_tiles = tiles.size();
+  for (int k = 0; k < n_tiles; k++) {
+    WorkQueue &q = *queues[(long)k * n_threads / n_tiles];
+    std::lock_guard<std::mutex> lk(q.lock);
+    q.tiles.push_back(tiles[k]);
+  }
+
+  std::unique_lock<std::mutex> lk(state_lock);
+  current_job = job;
+  active = n_threads;
+  generation++;
+  start_cv.notify_all();
+  done_cv.wait(lk, [this] { return active == 0; });
+}
+
+bool TileScheduler::next_tile(int w, Tile &tile) {
+  {
+    WorkQueue &own = *queues[w];
+    std::lock_guard<std::mutex> lk(own.lock);
+    if (!own.tiles.empty()) {
+      tile = own.tiles.back();
+      own.tiles.pop_back();
+      return true;
+    }
+  }
+
+  for (int k = 1; k < n_threads; k++) {
+    WorkQueue &victim = *queues[(w + k) % n_threads];
+    std::lock_guard<std::mutex> lk(victim.lock);
+    if (!victim.tiles.empty()) {
+      tile = victim.tiles.front();
+      victim.tiles.pop_front();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void TileScheduler::worker(int w) {
+  int seen = 0;
+  while (true) {
+    std::function<void(Tile)> job;
+    {
+      std::unique_lock<std::mutex> lk(state_lock);
+      start_cv.wait(lk, [&] { return stopping || generation != seen; });
+      if (stopping)
+        return;
+      seen = generation;
+      job = current_job;
+    }
+
+    Tile tile;
+    while (next_tile(w, tile))
+      job(tile);
+
+    std::lock_guard<std::mutex> lk(state_lock);
+    if (--active == 0)
+      done_cv.notify_all();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////
+//// SIMD dispatch
+
+SimdIsa detect_simd() {
+#if defined(__x86_64__) || defined(__i386__)
+  if (__builtin_cpu_supports("avx512f"))
+    return SimdIsa::AVX512;
+  if (__builtin_cpu_supports("avx2"))
+    return SimdIsa::AVX2;
+#endif
+  return SimdIsa::Scalar;
+}
+
+const char *simd_name(int isa) {
+  switch (isa) {
+  case SimdIsa::AVX2:
+    return "AVX2";
+  case SimdIsa::AVX512:
+    return "AVX-512";
+  default:
+    return "scalar";
+  }
+}
+
+int CpuBackend::escape_iter_run(const Complex_t *z, const Complex_t *c, int n,
+                                int MAXITER, int interior, int *iters) {
+#if defined(__x86_64__) || defined(__i386__)
+  if (simd == SimdIsa::AVX512) {
+    escape_iter_avx512(z, c, n, MAXITER, iters);
+    return 0;
+  }
+  if (simd == SimdIsa::AVX2) {
+    escape_iter_avx2(z, c, n, MAXITER, iters);
+    return 0;
+  }
+#endif
+  int early = 0;
+  for (int k = 0; k < n; k++) {
+    int e = 0;
+    iters[k] = _escape_iter(z[k], c[k], MAXITER, interior, &e);
+    early += e;
+  }
+  return early;
+}
+
+int CpuBackend::min_prox_run(const Complex_t *z, const Complex_t *c, int n,
+                             int MAXITER, int PROXTYPE, int interior,
+                             FPN *dist) {
+#if defined(__x86_64__) || defined(__i386__)
+  if (simd == SimdIsa::AVX512) {
+    min_prox_avx512(z, c, n, MAXITER, PROXTYPE, dist);
+    return 0;
+  }
+  if (simd == SimdIsa::AVX2) {
+    min_prox_avx2(z, c, n, MAXITER, PROXTYPE, dist);
+    return 0;
+  }
+#endif
+  int early = 0;
+  for (int k = 0; k < n; k++) {
+    int e = 0;
+    dist[k] = _minprox(z[k], c[k], MAXITER, PROXTYPE, interior, &e);
+    early += e;
+  }
+  return early;
+}
+
+////////////////////////////////////////////////////////////////////////////
+//// Kernels
+
+// same pixel -> complex plane mapping as in mandel.cl
+static inline Complex_t view_point(const FParam_t &param, int i, int j, int N,
+                                   int M) {
+  return {param.view_rect.left +
+              j * (param.view_rect.right - param.view_rect.left) / M,
+          param.view_rect.bot +
+              i * (param.view_rect.top - param.view_rect.bot) / N};
+}
+
+void CpuBackend::escape_iter(FPN *res, FParam_t param, int N, int M) {
+  bool bulbs = param.mandel && (param.interior & INTERIOR_BULBS);
+  pool.run(N, M, [&](Tile t) {
+    Complex_t p[run_length], _c[run_length];
+    int iters[run_length], at[run_length];
+    int early = 0;
+    for (int i = t.i0; i < t.i1; i++) {
+      for (int j0 = t.j0; j0 < t.j1; j0 += run_length) {
+        // points in the bulbs are left out of the run, so that they cannot
+        // hold up the other lanes of a vector
+        int n = std::min(run_length, t.j1 - j0), m = 0;
+        for (int k = 0; k < n; k++) {
+          Complex_t q = view_point(param, i, j0 + k, N, M);
+          if (bulbs && in_main_bulbs(q)) {
+            res[i * M + j0 + k] = FONE;
+            early++;
+            continue;
+          }
+          p[m] = q;
+          _c[m] = param.mandel ? q : param.c;
+          at[m++] = k;
+        }
+
+        early +=
+            escape_iter_run(p, _c, m, param.MAXITER, param.interior, iters);
+
+        for (int k = 0; k < m; k++)
+          res[i * M + j0 + at[k]] = ((FPN)iters[k]) / ((FPN)param.MAXITER);
+      }
+    }
+    early_exits += early;
+  });
+}
+
+void CpuBackend::min_prox(FPN *res, FParam_t param, int PROXTYPE, int N,
+                          int M) {
+  pool.run(N, M, [&](Tile t) {
+    Complex_t p[run_length], _c[run_length];
+    int early = 0;
+    for (int i = t.i0; i < t.i1; i++) {
+      for (int j0 = t.j0; j0 < t.j1; j0 += run_length) {
+        int n = std::min(run_length, t.j1 - j0);
+        for (int k = 0; k < n; k++) {
+          p[k] = view_point(param, i, j0 + k, N, M);
+          _c[k] = param.mandel ? p[k] : param.c;
+        }
+
+        early += min_prox_run(p, _c, n, param.MAXITER, PROXTYPE,
+                              param.interior, &res[i * M + j0]);
+      }
+    }
+    early_exits += early;
+  });
+}
+
+void CpuBackend::orbit_trap(FPN *res, FParam_t param, Box_t trap, bool real,
+                            int N, int M) {
+  pool.run(N, M, [&](Tile t) {
+    int early = 0;
+    for (int i = t.i0; i < t.i1; i++) {
+      for (int j = t.j0; j < t.j1; j++) {
+        Complex_t p = view_point(param, i, j, N, M);
+        Complex_t _c = param.mandel ? p : param.c;
+        int e = 0;
+        Complex_t uv =
+            _orbit_trap(p, _c, trap, param.MAXITER, param.interior, &e);
+        res[i * M + j] = real ? uv.re : uv.im;
+        early += e;
+      }
+    }
+    early_exits += early;
+  });
+}
+
+void CpuBackend::iterations(int *res, FParam_t param, int field, Box_t trap,
+                            int N, int M) {
+  bool bulbs = param.mandel && (param.interior & INTERIOR_BULBS);
+  pool.run(N, M, [&](Tile t) {
+    for (int i = t.i0; i < t.i1; i++) {
+      for (int j = t.j0; j < t.j1; j++) {
+        Complex_t z = view_point(param, i, j, N, M);
+        Complex_t c = param.mandel ? z : param.c;
+        Period_t period = period_start(z);
+        int n = 0;
+        bool skipped = field == 0 && bulbs && in_main_bulbs(c);
+        while (!skipped && n < param.MAXITER && (field == 2 || in_bounds(z))) {
+          z = f(z, c);
+          n += 1;
+          if (field == 2 && in_box(z, trap))
+            break;
+          if ((param.interior & INTERIOR_PERIOD) && period_found(&period, z))
+            break;
+        }
+        res[i * M + j] = n;
+      }
+    }
+  });
+}
+
+// runs body(i, j, d, dc) for the pixels a pass has to (re)compute
+template <typename Body>
+static void pert_pixels(TileScheduler &pool, FParam_t &param,
+                        DeepParam_t &deep, int *glitch, int N, int M,
+                        Body body) {
+  pool.run(N, M, [&](Tile t) {
+    for (int i = t.i0; i < t.i1; i++) {
+      for (int j = t.j0; j < t.j1; j++) {
+        if (deep.pass > 0 && !glitch[i * M + j])
+          continue;
+
+        Complex_t d = {deep.offset.re + j * deep.step.re,
+                       deep.offset.im + i * deep.step.im};
+        Complex_t dc = param.mandel ? d : Complex_t{FZERO, FZERO};
+        body(i, j, d, dc);
+      }
+    }
+  });
+}
+
+void CpuBackend::escape_iter_pert(FPN *res, FParam_t param, DeepParam_t deep,
+                                  Complex_t *ref, int *glitch, int N, int M) {
+  pert_pixels(pool, param, deep, glitch, N, M,
+              [&](int i, int j, Complex_t d, Complex_t dc) {
+                int g = 0;
+                res[i * M + j] = ((FPN)_escape_iter_pert(d, dc, ref,
+                                                         deep.ref_len,
+                                                         param.MAXITER, &g)) /
+                                 ((FPN)param.MAXITER);
+                glitch[i * M + j] = g;
+              });
+}
+
+void CpuBackend::min_prox_pert(FPN *res, FParam_t param, DeepParam_t deep,
+                               Complex_t *ref, int *glitch, int PROXTYPE,
+                               int N, int M) {
+  pert_pixels(pool, param, deep, glitch, N, M,
+              [&](int i, int j, Complex_t d, Complex_t dc) {
+                int g = 0;
+                res[i * M + j] = _minprox_pert(d, dc, ref, deep.ref_len,
+                                               param.MAXITER, PROXTYPE, &g);
+                glitch[i * M + j] = g;
+              });
+}
+
+void CpuBackend::orbit_trap_pert(FPN *res, FParam_t param, DeepParam_t deep,
+                                 Complex_t *ref, int *glitch, Box_t trap,
+                                 bool real, int N, int M) {
+  pert_pixels(pool, param, deep, glitch, N, M,
+              [&](int i, int j, Complex_t d, Complex_t dc) {
+                int g = 0;
+                Complex_t _c = param.mandel ? complex_add(ref[0], d) : param.c;
+                Complex_t uv = _orbit_trap_pert(d, dc, _c, trap, ref,
+                                                deep.ref_len, param.MAXITER, &g);
+                res[i * M + j] = real ? uv.re : uv.im;
+                glitch[i * M + j] = g;
+              });
+}
+
+// runs body(i, j, p, c) for every pixel, at double-float precision
+template <typename Body>
+static void df_pixels(TileScheduler &pool, FParam_t &param, DFParam_t &view,
+                      std::atomic<int> &early_exits, int N, int M, Body body) {
+  pool.run(N, M, [&](Tile t) {
+    int early = 0;
+    for (int i = t.i0; i < t.i1; i++) {
+      for (int j = t.j0; j < t.j1; j++) {
+        DFComplex_t p = df_point(view, i, j);
+        DFComplex_t _c = param.mandel ? p : view.c;
+        early += body(i, j, p, _c);
+      }
+    }
+    early_exits += early;
+  });
+}
+
+void CpuBackend::escape_iter_df(FPN *res, FParam_t param, DFParam_t view,
+                                int N, int M) {
+  df_pixels(pool, param, view, early_exits, N, M,
+            [&](int i, int j, DFComplex_t p, DFComplex_t _c) {
+              int e = 0;
+              res[i * M + j] = ((FPN)_escape_iter_df(p, _c, param.MAXITER,
+                                                     param.interior, &e)) /
+                               ((FPN)param.MAXITER);
+              return e;
+            });
+}
+
+void CpuBackend::min_prox_df(FPN *res, FParam_t param, DFParam_t view,
+                             int PROXTYPE, int N, int M) {
+  df_pixels(pool, param, view, early_exits, N, M,
+            [&](int i, int j, DFComplex_t p, DFComplex_t _c) {
+              int e = 0;
+              res[i * M + j] = _minprox_df(p, _c, param.MAXITER, PROXTYPE,
+                                           param.interior, &e);
+              return e;
+            });
+}
+
+void CpuBackend::orbit_trap_df(FPN *res, FParam_t param, DFParam_t view,
+                               Box_t trap, bool real, int N, int M) {
+  df_pixels(pool, param, view, early_exits, N, M,
+            [&](int i, int j, DFComplex_t p, DFComplex_t _c) {
+              int e = 0;
+              Complex_t uv = _orbit_trap_df(p, _c, trap, param.MAXITER,
+                                            param.interior, &e);
+              res[i * M + j] = real ? uv.re : uv.im;
+              return e;
+            });
+}
+
+void CpuBackend::map_sines(FPN *res, Pixel_t *img, Freqs_t freqs, int N,
+                           int M) {
+  pool.run(N, M, [&](Tile t) {
+    for (int i = t.i0; i < t.i1; i++) {
+      for (int j = t.j0; j < t.j1; j++) {
+        FPN x = res[i * M + j];
+        img[i * M + j] = {(unsigned char)(127 * (std::sin(x * freqs.f1) + 1)),
+                          (unsigned char)(127 * (std::sin(x * freqs.f2) + 1)),
+                          (unsigned char)(127 * (std::sin(x * freqs.f3) + 1))};
+      }
+    }
+  });
+}
+
+void CpuBackend::map_img(FPN *res1, FPN *res2, Pixel_t *sim, ImDims_t dims,
+                         Pixel_t *mim, int N, int M) {
+  pool.run(N, M, [&](Tile t) {
+    for (int i = t.i0; i < t.i1; i++) {
+      for (int j = t.j0; j < t.j1; j++) {
+        int _i = (int)(((float)(dims.imH - 1)) * res1[i * M + j]);
+        int _j = (int)(((float)(dims.imW - 1)) * res2[i * M + j]);
+        mim[i * M + j] = sim[_i * dims.imW + _j];
+      }
+    }
+  });
+}
+
+void CpuBackend::pack(FPN *res1, FPN *res2, FPN *res3, Pixel_t *img,
+                      bool norm, int N, int M) {
+  pool.run(N, M, [&](Tile t) {
+    for (int i = t.i0; i < t.i1; i++) {
+      for (int j = t.j0; j < t.j1; j++) {
+        int k = i * M + j;
+        FPN s = norm ? res1[k] + res2[k] + res3[k] : FONE;
+        img[k] = {(unsigned char)(255 * res1[k] / s),
+                  (unsigned char)(255 * res2[k] / s),
+                  (unsigned char)(255 * res3[k] / s)};
+      }
+    }
+  });
+}
+
+void CpuBackend::field_stats(FPN *res, float clip, FieldStats_t &s, float *cdf,
+                             int N, int M) {
+  std::mutex lock;
+  s.min = INFINITY;
+  s.max = -INFINITY;
+  pool.run(N, M, [&](Tile t) {
+    FPN min = INFINITY, max = -INFINITY;
+    for (int i = t.i0; i < t.i1; i++) {
+      for (int j = t.j0; j < t.j1; j++) {
+        FPN v = res[i * M + j];
+        if (std::isfinite(v)) {
+          min = std::min(min, v);
+          max = std::max(max, v);
+        }
+      }
+    }
+    std::lock_guard<std::mutex> lk(lock);
+    s.min = std::min(s.min, min);
+    s.max = std::max(s.max, max);
+  });
+  s.hmin = s.min;
+  s.hmax = s.max;
+
+  // as the kernels, over min..max and then over the refined range
+  for (int refine = 1; refine >= 0; refine--) {
+    std::vector<std::atomic<int>> bins(HIST_BINS + 2);
+    pool.run(N, M, [&](Tile t) {
+      for (int i = t.i0; i < t.i1; i++) {
+        for (int j = t.j0; j < t.j1; j++) {
+          FPN v = res[i * M + j];
+          if (std::isfinite(v))
+            bins[hist_bin(v, s)].fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+    });
+    int hist[HIST_BINS + 2];
+    for (int b = 0; b < HIST_BINS + 2; b++)
+      hist[b] = bins[b];
+    hist_finish(hist, &s, clip, cdf, refine);
+  }
+}
+
+void CpuBackend::tone(FPN *res, FPN *out, FieldStats_t s, float *cdf, int mode,
+                      int N, int M) {
+  pool.run(N, M, [&](Tile t) {
+    for (int i = t.i0; i < t.i1; i++) {
+      for (int j = t.j0; j < t.j1; j++)
+        out[i * M + j] = tone_map(res[i * M + j], s, cdf, mode);
+    }
+  });
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../mandelstructs.h"
+#include "cpu_simd.hpp"
+
+////////////////////////////////////////////////////////////////////////////
+//// Tile scheduler
+
+struct Tile {
+  int i0, j0; // first row/col
+  int i1, j1; // one past last row/col
+};
+
+class TileScheduler
+// Thread pool that splits a frame into tiles. Each worker starts with a
+// contiguous run of tiles in its own deque and pops from the back, once empty
+// it steals from the front of the others. Interior tiles can take MAXITER
+// times longer than exterior ones, so static splits would leave cores idle.
+{
+public:
+  int n_threads;
+  int tile_size = 32;
+
+  TileScheduler(int threads = 0);
+  ~TileScheduler();
+
+  // blocks until job has been applied to every tile covering the N x M frame
+  void run(int N, int M, std::function<void(Tile)> job);
+
+private:
+  struct WorkQueue {
+    std::mutex lock;
+    std::deque<Tile> tiles;
+  };
+
+  std::vector<std::unique_ptr<WorkQueue>> queues;
+  std::vector<std::thread> threads;
+
+  std::mutex state_lock;
+  std::condition_variable start_cv;
+  std::condition_variable done_cv;
+  std::function<void(Tile)> current_job;
+  int generation = 0;
+  int active = 0;
+  bool stopping = false;
+
+  bool next_tile(int w, Tile &tile);
+  void worker(int w);
+};
+
+////////////////////////////////////////////////////////////////////////////
+//// Host versions of the kernels in mandel.cl
+
+class CpuBackend
+// Runs the routines from mandelutils.c natively. Note that the recursed
+// function is the one compiled into the binary, edits in the UI only reach the
+// OpenCL kernels.
+{
+public:
+  TileScheduler pool;
+
+  // escape_iter and min_prox go through vector kernels when available, these
+  // hard code z^2 + c, so should be set to Scalar if f in mandelutils.c changes
+  int simd_supported = detect_simd();
+  int simd = simd_supported;
+
+  // pixels stopped early by interior detection (see FParam_t::interior),
+  // added to by the iterating kernels below until read and reset
+  std::atomic<int> early_exits{0};
+
+  void escape_iter(FPN *res, FParam_t param, int N, int M);
+  void min_prox(FPN *res, FParam_t param, int PROXTYPE, int N, int M);
+  void orbit_trap(FPN *res, FParam_t param, Box_t trap, bool real, int N,
+                  int M);
+
+  // perturbation versions, see DeepZoom
+  void escape_iter_pert(FPN *res, FParam_t param, DeepParam_t deep,
+                        Complex_t *ref, int *glitch, int N, int M);
+  void min_prox_pert(FPN *res, FParam_t param, DeepParam_t deep,
+                     Complex_t *ref, int *glitch, int PROXTYPE, int N, int M);
+  void orbit_trap_pert(FPN *res, FParam_t param, DeepParam_t deep,
+                       Complex_t *ref, int *glitch, Box_t trap, bool real,
+                       int N, int M);
+
+  // double-float versions, see DFParam_t
+  void escape_iter_df(FPN *res, FParam_t param, DFParam_t view, int N, int M);
+  void min_prox_df(FPN *res, FParam_t param, DFParam_t view, int PROXTYPE,
+                   int N, int M);
+  void orbit_trap_df(FPN *res, FParam_t param, DFParam_t view, Box_t trap,
+                     bool real, int N, int M);
+
+  void map_sines(FPN *res, Pixel_t *img, Freqs_t freqs, int N, int M);
+  void map_img(FPN *res1, FPN *res2, Pixel_t *sim, ImDims_t dims,
+               Pixel_t *mim, int N, int M);
+  void pack(FPN *res1, FPN *res2, FPN *res3, Pixel_t *img, bool norm, int N,
+            int M);
+
+  // iterations the loop of _escape_iter (field 0), _minprox (1) or
+  // _orbit_trap (2) runs per pixel, early exits included, as a measure of the
+  // work of a kernel (fractalbench)
+  void iterations(int *res, FParam_t param, int field, Box_t trap, int N,
+                  int M);
+
+  // of the N x M field res, see FieldStats_t, cdf taking HIST_BINS
+  void field_stats(FPN *res, float clip, FieldStats_t &s, float *cdf, int N,
+                   int M);
+  // res as given to the colormaps in mode (TONE_*), into out
+  void tone(FPN *res, FPN *out, FieldStats_t s, float *cdf, int mode, int N,
+            int M);
+
+private:
+  // a run of pixels along a tile row, dispatched on the selected ISA
+  static constexpr int run_length = 64;
+  // return the number of early exits, the vector kernels have none
+  int escape_iter_run(const Complex_t *z, const Complex_t *c, int n,
+                      int MAXITER, int interior, int *iters);
+  int min_prox_run(const Complex_t *z, const Complex_t *c, int n, int MAXITER,
+                   int PROXTYPE, int interior, FPN *dist);
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "../mandelstructs.h"
+
+// Explicitly vectorised versions of _escape_iter and _minprox for the default
+// recursed function (z^2 + c). Lanes are masked off as they escape, so results
+// are bit-identical to the scalar routines in mandelutils.c.
+//
+// The ISA specific entry points live in their own translation units, built
+// with the matching -m flags, the one to use is picked at runtime.
+
+enum SimdIsa { Scalar = 0, AVX2 = 1, AVX512 = 2 };
+
+SimdIsa detect_simd();
+const char *simd_name(int isa);
+
+// z and c are runs of n pixels, results are written per pixel
+void escape_iter_avx2(const Complex_t *z, const Complex_t *c, int n,
+                      int MAXITER, int *iters);
+void min_prox_avx2(const Complex_t *z, const Complex_t *c, int n, int MAXITER,
+                   int PROXTYPE, FPN *dist);
+
+void escape_iter_avx512(const Complex_t *z, const Complex_t *c, int n,
+                        int MAXITER, int *iters);
+void min_prox_avx512(const Complex_t *z, const Complex_t *c, int n,
+                     int MAXITER, int PROXTYPE, FPN *dist);
@@ -0,0 +1,66 @@
+// Built with -mavx2 -ffp-contract=off (see Makefile), so mul/add pairs
+// are never fused and the results match the scalar loop bit for bit.
+#ifdef __AVX2__
+
+#include <immintrin.h>
+
+#include "cpu_simd.hpp"
+#include "cpu_simd_kernels.hpp"
+
+namespace {
+
+#ifdef USE_FLOAT
+struct Avx2 {
+  typedef __m256 V;
+  typedef __m256 M;
+  static const int W = 8;
+
+  static V set1(FPN x) { return _mm256_set1_ps(x); }
+  static V load(const FPN *p) { return _mm256_loadu_ps(p); }
+  static void store(FPN *p, V v) { _mm256_storeu_ps(p, v); }
+  static V add(V a, V b) { return _mm256_add_ps(a, b); }
+  static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+  static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+  static V min(V a, V b) { return _mm256_min_ps(a, b); } // a < b ? a : b
+  static V neg(V a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f)); }
+  static M lt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+  static M gt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+  static M both(M a, M b) { return _mm256_and_ps(a, b); }
+  static V select(M m, V a, V b) { return _mm256_blendv_ps(b, a, m); }
+  static int bits(M m) { return _mm256_movemask_ps(m); }
+};
+#else
+struct Avx2 {
+  typedef __m256d V;
+  typedef __m256d M;
+  static const int W = 4;
+
+  static V set1(FPN x) { return _mm256_set1_pd(x); }
+  static V load(const FPN *p) { return _mm256_loadu_pd(p); }
+  static void store(FPN *p, V v) { _mm256_storeu_pd(p, v); }
+  static V add(V a, V b) { return _mm256_add_pd(a, b); }
+  static V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+  static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+  static V min(V a, V b) { return _mm256_min_pd(a, b); } // a < b ? a : b
+  static V neg(V a) { return _mm256_xor_pd(a, _mm256_set1_pd(-0.0)); }
+  static M lt(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+  static M gt(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+  static M both(M a, M b) { return _mm256_and_pd(a, b); }
+  static V select(M m, V a, V b) { return _mm256_blendv_pd(b, a, m); }
+  static int bits(M m) { return _mm256_movemask_pd(m); }
+};
+#endif
+
+} // namespace
+
+void escape_iter_avx2(const Complex_t *z, const Complex_t *c, int n,
+                      int MAXITER, int *iters) {
+  escape_iter_simd<Avx2>(z, c, n, MAXITER, iters);
+}
+
+void min_prox_avx2(const Complex_t *z, const Complex_t *c, int n, int MAXITER,
+                   int PROXTYPE, FPN *dist) {
+  min_prox_simd<Avx2>(z, c, n, MAXITER, PROXTYPE, dist);
+}
+
+#endif
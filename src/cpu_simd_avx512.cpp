@@ -0,0 +1,74 @@
+// Built with -mavx512f -ffp-contract=off (see Makefile), so mul/add pairs
+// are never fused and the results match the scalar loop bit for bit.
+#ifdef __AVX512F__
+
+#include <immintrin.h>
+
+#include "cpu_simd.hpp"
+#include "cpu_simd_kernels.hpp"
+
+namespace {
+
+#ifdef USE_FLOAT
+struct Avx512 {
+  typedef __m512 V;
+  typedef __mmask16 M;
+  static const int W = 16;
+
+  static V set1(FPN x) { return _mm512_set1_ps(x); }
+  static V load(const FPN *p) { return _mm512_loadu_ps(p); }
+  static void store(FPN *p, V v) { _mm512_storeu_ps(p, v); }
+  static V add(V a, V b) { return _mm512_add_ps(a, b); }
+  static V sub(V a, V b) { return _mm512_sub_ps(a, b); }
+  static V mul(V a, V b) { return _mm512_mul_ps(a, b); }
+  static V min(V a, V b) { return _mm512_min_ps(a, b); } // a < b ? a : b
+  static V neg(V a) // xor_ps needs AVX512DQ
+  {
+    return _mm512_castsi512_ps(_mm512_xor_si512(
+        _mm512_castps_si512(a), _mm512_castps_si512(_mm512_set1_ps(-0.0f))));
+  }
+  static M lt(V a, V b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+  static M gt(V a, V b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+  static M both(M a, M b) { return a & b; }
+  static V select(M m, V a, V b) { return _mm512_mask_blend_ps(m, b, a); }
+  static int bits(M m) { return m; }
+};
+#else
+struct Avx512 {
+  typedef __m512d V;
+  typedef __mmask8 M;
+  static const int W = 8;
+
+  static V set1(FPN x) { return _mm512_set1_pd(x); }
+  static V load(const FPN *p) { return _mm512_loadu_pd(p); }
+  static void store(FPN *p, V v) { _mm512_storeu_pd(p, v); }
+  static V add(V a, V b) { return _mm512_add_pd(a, b); }
+  static V sub(V a, V b) { return _mm512_sub_pd(a, b); }
+  static V mul(V a, V b) { return _mm512_mul_pd(a, b); }
+  static V min(V a, V b) { return _mm512_min_pd(a, b); } // a < b ? a : b
+  static V neg(V a) // xor_pd needs AVX512DQ
+  {
+    return _mm512_castsi512_pd(_mm512_xor_si512(
+        _mm512_castpd_si512(a), _mm512_castpd_si512(_mm512_set1_pd(-0.0))));
+  }
+  static M lt(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+  static M gt(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+  static M both(M a, M b) { return a & b; }
+  static V select(M m, V a, V b) { return _mm512_mask_blend_pd(m, b, a); }
+  static int bits(M m) { return m; }
+};
+#endif
+
+} // namespace
+
+void escape_iter_avx512(const Complex_t *z, const Complex_t *c, int n,
+                        int MAXITER, int *iters) {
+  escape_iter_simd<Avx512>(z, c, n, MAXITER, iters);
+}
+
+void min_prox_avx512(const Complex_t *z, const Complex_t *c, int n,
+                     int MAXITER, int PROXTYPE, FPN *dist) {
+  min_prox_simd<Avx512>(z, c, n, MAXITER, PROXTYPE, dist);
+}
+
+#endif
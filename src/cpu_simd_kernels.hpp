@@ -0,0 +1,119 @@
+#pragma once
+
+// Lane-generic kernels, only to be included by the cpu_simd_*.cpp files after
+// defining a traits struct S with the vector ops (see cpu_simd_avx2.cpp).
+// Everything is in an anonymous namespace so the ISA specific instantiations
+// can never be picked up by code built without those flags.
+
+#include "../mandelstructs.h"
+
+namespace {
+
+template <class S> struct Lanes {
+  typedef typename S::V V;
+  typedef typename S::M M;
+
+  V zr, zi, cr, ci;
+  int n; // lanes in use, the rest are padded with points outside the circle
+
+  Lanes(const Complex_t *z, const Complex_t *c, int count) {
+    FPN _zr[S::W], _zi[S::W], _cr[S::W], _ci[S::W];
+    n = count < S::W ? count : S::W;
+    for (int l = 0; l < S::W; l++) {
+      _zr[l] = l < n ? z[l].re : 4 * FONE;
+      _zi[l] = l < n ? z[l].im : FZERO;
+      _cr[l] = l < n ? c[l].re : FZERO;
+      _ci[l] = l < n ? c[l].im : FZERO;
+    }
+    zr = S::load(_zr);
+    zi = S::load(_zi);
+    cr = S::load(_cr);
+    ci = S::load(_ci);
+  }
+
+  // in_bounds, i.e. in_circle(z, 0, 2)
+  M in_bounds() const {
+    V r = S::set1(2);
+    return S::lt(S::add(S::mul(zr, zr), S::mul(zi, zi)), S::mul(r, r));
+  }
+
+  // z = f(z, c) for the active lanes, same operation order as complex_mult
+  void step(M active) {
+    V re = S::add(S::sub(S::mul(zr, zr), S::mul(zi, zi)), cr);
+    V im = S::add(S::add(S::mul(zi, zr), S::mul(zr, zi)), ci);
+    zr = S::select(active, re, zr);
+    zi = S::select(active, im, zi);
+  }
+
+  V proximity(int PROXTYPE) const {
+    V res = S::set1(1000 * FONE);
+    if (PROXTYPE & 1)
+      res = S::min(res, S::add(S::mul(zr, zr), S::mul(zi, zi)));
+    if (PROXTYPE & 2)
+      res = S::min(res, abs(zr));
+    if (PROXTYPE & 4)
+      res = S::min(res, abs(zi));
+    return res;
+  }
+
+  // _abs, which gives -0 for 0
+  static V abs(V x) { return S::select(S::gt(x, S::set1(FZERO)), x, S::neg(x)); }
+};
+
+template <class S>
+void escape_iter_simd(const Complex_t *z, const Complex_t *c, int n,
+                      int MAXITER, int *iters) {
+  for (int k = 0; k < n; k += S::W) {
+    Lanes<S> L(z + k, c + k, n - k);
+
+    typename S::M active = L.in_bounds();
+    int live = S::bits(active);
+    int count[S::W] = {0};
+
+    int i = 0;
+    while (live && i < MAXITER) {
+      L.step(active);
+      i += 1;
+
+      active = S::both(active, L.in_bounds());
+      int now = S::bits(active);
+      for (int gone = live & ~now; gone; gone &= gone - 1)
+        count[__builtin_ctz(gone)] = i;
+      live = now;
+    }
+    for (; live; live &= live - 1)
+      count[__builtin_ctz(live)] = i;
+
+    for (int l = 0; l < L.n; l++)
+      iters[k + l] = count[l];
+  }
+}
+
+template <class S>
+void min_prox_simd(const Complex_t *z, const Complex_t *c, int n, int MAXITER,
+                   int PROXTYPE, FPN *dist) {
+  for (int k = 0; k < n; k += S::W) {
+    Lanes<S> L(z + k, c + k, n - k);
+
+    typename S::V d = L.proximity(PROXTYPE);
+    typename S::M active = L.in_bounds();
+    int live = S::bits(active);
+
+    int i = 0;
+    while (live && i < MAXITER) {
+      L.step(active);
+      d = S::select(active, S::min(d, L.proximity(PROXTYPE)), d);
+      i += 1;
+
+      active = S::both(active, L.in_bounds());
+      live = S::bits(active);
+    }
+
+    FPN _d[S::W];
+    S::store(_d, d);
+    for (int l = 0; l < L.n; l++)
+      dist[k + l] = _d[l];
+  }
+}
+
+} // namespace
@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <cmath>
+
+#include "deep_zoom.hpp"
+
+DeepZoom::DeepZoom() { set_center(-0.75, 0); }
+
+void DeepZoom::set_center(FPN re, FPN im) {
+  center_re = mpf_class(re, prec);
+  center_im = mpf_class(im, prec);
+}
+
+void DeepZoom::pan(FPN dre, FPN dim) {
+  center_re += dre;
+  center_im += dim;
+}
+
+std::string DeepZoom::center_str(int digits) {
+  char buff[256];
+  gmp_snprintf(buff, sizeof(buff), "(%.*Fg) + (%.*Fg)i", digits,
+               center_re.get_mpf_t(), digits, center_im.get_mpf_t());
+  return buff;
+}
+
+void DeepZoom::reference(FParam_t param, Complex_t deltas, int N, int M) {
+  // enough bits to resolve a pixel, plus headroom for the orbit
+  FPN pixel = 2 * deltas.re / M;
+  prec = 64 + (mp_bitcnt_t)std::max(0.0, -std::log2((double)pixel));
+  center_re.set_prec(prec);
+  center_im.set_prec(prec);
+
+  // view_rect is meaningless at these depths, it is not part of the key
+  references = 1;
+  if (prec == cached_prec && cached_re == center_re &&
+      cached_im == center_im && param.mandel == cached_param.mandel &&
+      param.c.re == cached_param.c.re && param.c.im == cached_param.c.im &&
+      param.MAXITER == cached_param.MAXITER) {
+    ref_re = cached_re;
+    ref_im = cached_im;
+    orbit = center_orbit;
+    return;
+  }
+
+  ref_re = mpf_class(center_re, prec);
+  ref_im = mpf_class(center_im, prec);
+  compute_orbit(param);
+
+  center_orbit = orbit;
+  cached_re = ref_re;
+  cached_im = ref_im;
+  cached_param = param;
+  cached_prec = prec;
+}
+
+void DeepZoom::rereference(FParam_t param, Complex_t d) {
+  ref_re += d.re;
+  ref_im += d.im;
+  compute_orbit(param);
+  references++;
+}
+
+DeepParam_t DeepZoom::pixel_map(Complex_t deltas, int N, int M) {
+  mpf_class dre(center_re - ref_re, prec);
+  mpf_class dim(center_im - ref_im, prec);
+
+  DeepParam_t deep;
+  deep.offset = {(FPN)dre.get_d() - deltas.re, (FPN)dim.get_d() - deltas.im};
+  deep.step = {2 * deltas.re / M, 2 * deltas.im / N};
+  deep.ref_len = orbit.size();
+  deep.pass = 0;
+  return deep;
+}
+
+static DF_t df_of(const mpf_class &x) {
+  float hi = (float)x.get_d();
+  mpf_class rest = x - hi;
+  return {hi, (float)rest.get_d()};
+}
+
+DFParam_t DeepZoom::df_map(FParam_t param, Complex_t deltas, int N, int M) {
+  DFParam_t view;
+  view.origin = {df_of(center_re - deltas.re), df_of(center_im - deltas.im)};
+  view.step_re = df_of(mpf_class(2 * (double)deltas.re / M, prec));
+  view.step_im = df_of(mpf_class(2 * (double)deltas.im / N, prec));
+  view.c = {df_of(mpf_class(param.c.re, prec)),
+            df_of(mpf_class(param.c.im, prec))};
+  return view;
+}
+
+void DeepZoom::compute_orbit(FParam_t param)
+// Z_0 is the reference point itself, matching z = p in the kernels
+{
+  mpf_class zr(ref_re, prec), zi(ref_im, prec), t(0, prec);
+  mpf_class cr(param.mandel ? ref_re : mpf_class(param.c.re), prec);
+  mpf_class ci(param.mandel ? ref_im : mpf_class(param.c.im), prec);
+
+  orbit.clear();
+  for (int n = 0;; n++) {
+    orbit.push_back({(FPN)zr.get_d(), (FPN)zi.get_d()});
+    if (n >= param.MAXITER || zr * zr + zi * zi > 4)
+      break;
+
+    t = zr * zr - zi * zi + cr;
+    zi = 2 * zr * zi + ci;
+    zr = t;
+  }
+}
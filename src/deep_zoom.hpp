@@ -0,0 +1,51 @@
+#pragma once
+
+#include <gmpxx.h>
+#include <string>
+#include <vector>
+
+#include "../mandelstructs.h"
+
+class DeepZoom
+// Keeps the view center at arbitrary precision (GMP) and computes the
+// reference orbits used by the perturbation kernels, so that zooming is no
+// longer limited by FPN. Only the per pixel offsets from the reference have to
+// fit in an FPN, which holds down to ~1e-300 for doubles (~1e-38 for floats).
+{
+public:
+  mpf_class center_re, center_im;
+  mpf_class ref_re, ref_im; // point the current orbit was computed for
+
+  std::vector<Complex_t> orbit;
+
+  int max_passes = 8; // re-referencing passes per field
+  int glitched = 0;   // pixels still glitched after the last field
+  int references = 0; // orbits computed for the last field
+
+  DeepZoom();
+
+  void set_center(FPN re, FPN im);
+  void pan(FPN dre, FPN dim);
+  std::string center_str(int digits = 20);
+
+  // orbit for the view center, only recomputed when the view or params change
+  void reference(FParam_t param, Complex_t deltas, int N, int M);
+  // move the reference by d (relative to the current one) and recompute
+  void rereference(FParam_t param, Complex_t d);
+
+  // maps pixels to offsets from the current reference
+  DeepParam_t pixel_map(Complex_t deltas, int N, int M);
+  // maps pixels to the view center in double-float, for the *_df kernels
+  DFParam_t df_map(FParam_t param, Complex_t deltas, int N, int M);
+
+private:
+  mp_bitcnt_t prec = 64;
+
+  // cached orbit for the view center
+  std::vector<Complex_t> center_orbit;
+  mpf_class cached_re, cached_im;
+  FParam_t cached_param = {};
+  mp_bitcnt_t cached_prec = 0;
+
+  void compute_orbit(FParam_t param);
+};
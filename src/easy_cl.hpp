@@ -2,12 +2,25 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <random>
 #include <regex>
 #include <sstream>
+#include <type_traits>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
 
 #ifdef __APPLE__
 #include <OpenCL/cl.hpp>
@@ -59,18 +72,35 @@ public:
   }
 };
 
+// Which side holds the latest data
+enum Residency { InSync = 0, HostDirty = 1, DeviceDirty = 2 };
+
 // To simplify some function prototypes, that don't need template knowledge
 class AbstractSynchronisedArray {
 public:
   Dims dims;
   int items;
+  int buffsize;
 
   cl::Buffer gpu_buff;
   cl_mem_flags mem_flags;
+  int state = HostDirty;
 
-  virtual void to_gpu(cl::CommandQueue &queue) = 0;
+  // transfer only if the other side is stale, return whether a transfer was
+  // enqueued (event is set if so)
+  virtual bool to_gpu(cl::CommandQueue &queue, cl::Event *event = nullptr) = 0;
 
-  virtual void from_gpu(cl::CommandQueue &queue) = 0;
+  virtual bool from_gpu(cl::CommandQueue &queue,
+                        cl::Event *event = nullptr) = 0;
+
+  // after writing to the host buffer directly
+  void mark_host_dirty() { state = HostDirty; }
+
+  // after a kernel that may have written to it
+  void mark_device_dirty() {
+    if (mem_flags != CL_MEM_READ_ONLY)
+      state = DeviceDirty;
+  }
 
   // virtual ~AbstractSynchronisedArray() = 0; // not sure why I cant do this,
   // don't delete base pointer...
@@ -79,11 +109,15 @@ public:
 template <typename T>
 class SynchronisedArray : public AbstractSynchronisedArray {
 public:
-  int buffsize;
   bool no_copy_back; // dont copy back even if not read only
 
   T *cpu_buff;
 
+private:
+  std::vector<T> staging; // being uploaded
+  cl::Event staged;
+
+public:
   SynchronisedArray(){};
 
   SynchronisedArray(cl::Context &context, cl_mem_flags flags, Dims dimensions) {
@@ -95,29 +129,63 @@ public:
 
     buffsize = sizeof(T) * items;
     cpu_buff = new T[items];
-    gpu_buff = cl::Buffer(context, flags, buffsize);
+    if (context() != nullptr) // host only when there is no OpenCL device
+      gpu_buff = cl::Buffer(context, flags, buffsize);
   }
 
   SynchronisedArray(cl::Context &context, Dims dimensions = {})
       : SynchronisedArray(context, CL_MEM_READ_WRITE, dimensions) {}
 
-  ~SynchronisedArray() { delete[] cpu_buff; }
+  ~SynchronisedArray() {
+    if (staged() != nullptr)
+      staged.wait();
+    delete[] cpu_buff;
+  }
+
+  bool to_gpu(cl::CommandQueue &queue, cl::Event *event = nullptr) {
+    if (state != HostDirty ||
+        mem_flags == CL_MEM_WRITE_ONLY) // gpu will not need to read it, no
+                                        // need to copy to
+      return false;
+    // uploads from a copy without waiting, so that queueing the next frame
+    // does not wait for the device to catch up, cpu_buff is free to change
+    if (staged() != nullptr)
+      staged.wait(); // the previous upload, long done in practice
+    staging.assign(cpu_buff, cpu_buff + items);
+    queue.enqueueWriteBuffer(gpu_buff, CL_FALSE, 0, buffsize, staging.data(),
+                             nullptr, &staged);
+    if (event)
+      *event = staged;
+    state = InSync;
+    return true;
+  }
 
-  void to_gpu(cl::CommandQueue &queue) {
-    if (mem_flags != CL_MEM_WRITE_ONLY) // otherwise gpu will not need to read
-                                        // it, no need to copy to
-      queue.enqueueWriteBuffer(gpu_buff, CL_TRUE, 0, buffsize, cpu_buff);
+  bool from_gpu(cl::CommandQueue &queue, cl::Event *event = nullptr) {
+    if (state != DeviceDirty || no_copy_back) // nothing new on the device, or
+                                              // not wanted back
+      return false;
+    queue.enqueueReadBuffer(gpu_buff, CL_TRUE, 0, buffsize, cpu_buff, nullptr,
+                            event);
+    state = InSync;
+    return true;
   }
 
-  void from_gpu(cl::CommandQueue &queue) {
-    if (mem_flags != CL_MEM_READ_ONLY &&
-        !no_copy_back) // if either mem_flags==CL_MEM_READ_ONLY or no_copy_back,
-                       // we skip
-      queue.enqueueReadBuffer(gpu_buff, CL_TRUE, 0, buffsize, cpu_buff);
+  // copies count items in at offset, only marking the host side dirty if they
+  // differ, so unchanged inputs are not uploaded again
+  bool update(const T *values, int count = 1, int offset = 0) {
+    assert(offset + count <= items);
+    if (state != HostDirty &&
+        memcmp(cpu_buff + offset, values, sizeof(T) * count) == 0)
+      return false;
+    memcpy(cpu_buff + offset, values, sizeof(T) * count);
+    state = HostDirty;
+    return true;
   }
 
+  // non-const access is assumed to write, use cpu_buff to only read
   T &operator[](std::size_t i) {
     assert(i < dims.x);
+    state = HostDirty;
     return cpu_buff[i];
   }
 
@@ -125,6 +193,7 @@ public:
   {
     assert(i < dims.x);
     assert(j < dims.y);
+    state = HostDirty;
     return cpu_buff[i * dims.y + j];
   }
 
@@ -132,6 +201,7 @@ public:
     assert(i < dims.x);
     assert(j < dims.y);
     assert(k < dims.z);
+    state = HostDirty;
     return cpu_buff[(i * dims.y + j) * dims.z + k];
   }
 };
@@ -159,6 +229,18 @@ void from_gpu(cl::CommandQueue &queue, AbstractSynchronisedArray &first_arr,
   from_gpu(queue, arrs...);
 }
 
+////////////////////////////////////////////////////////////////////////////
+//// Profiling
+
+enum ProfileStage { Upload = 0, Compute = 1, Download = 2 };
+
+struct ProfileRecord {
+  std::string name;
+  int stage;
+  int frame;
+  cl_ulong queued, start, end; // ns, device clock
+};
+
 ////////////////////////////////////////////////////////////////////////////
 //// Main class
 
@@ -168,12 +250,38 @@ public:
   cl::Device device;
   cl::CommandQueue queue;
 
+  // created on first use (see get_kernel) from the program that provides them.
+  // Names may carry a "@variant" suffix, telling apart the same kernel from
+  // several builds of one source
   std::map<std::string, cl::Kernel> kernels;
+  std::map<std::string, cl::Program> kernel_programs;
 
   bool _verbose;
+  bool available = true; // false if no OpenCL device was found
   bool no_block = false;
+  unsigned long launched = 0; // kernels enqueued so far
+  cl_int launch_error = CL_SUCCESS; // of the last enqueue
+
+  // local work-group shapes per kernel (without @variant), see autotune.
+  // Kernels given one get their 2D global range padded up to a multiple of
+  // it, so must ignore the work items past their data
+  std::map<std::string, Dims> local_shapes;
+  // if set, local_shapes are kept here as "device<TAB>kernel<TAB>x<TAB>y"
+  // lines, for any number of devices (see load_tuning/save_tuning)
+  std::string tuning_file = "";
   std::string cl_error = "";
 
+  // if set, built programs are saved here (CL_PROGRAM_BINARIES) and loaded
+  // instead of compiling when the same source, options and driver come again
+  std::string binary_cache_dir = "";
+  bool from_cache = false; // of the last load_source
+
+  // opt-in, see set_profiling
+  bool profiling = false;
+  int profile_frame = 0; // tag for new records, up to the user to advance
+  size_t profile_capacity = 4096;
+  std::deque<ProfileRecord> profile;
+
   EasyCL(bool verbose = false) {
     _verbose = verbose;
 
@@ -186,7 +294,8 @@ public:
 
     if (all_platforms.size() == 0) {
       std::cout << " No platforms found. Check OpenCL installation!\n";
-      exit(1);
+      available = false;
+      return;
     }
     cl::Platform default_platform = all_platforms[0];
 
@@ -194,7 +303,8 @@ public:
     default_platform.getDevices(CL_DEVICE_TYPE_ALL, &all_devices);
     if (all_devices.size() == 0) {
       std::cout << " No devices found. Check OpenCL installation!\n";
-      exit(1);
+      available = false;
+      return;
     }
 
     device = all_devices[0];
@@ -208,17 +318,58 @@ public:
     }
   }
 
+  EasyCL(cl::Device device, bool verbose = false)
+  // on a given device, e.g. from all_devices
+  {
+    _verbose = verbose;
+    this->device = device;
+    context = cl::Context({device});
+    queue = cl::CommandQueue(context, device);
+
+    if (_verbose)
+      std::cout << "Using device: " << device.getInfo<CL_DEVICE_NAME>() << "\n";
+  }
+
+  static std::vector<cl::Device> all_devices(int cpu_split = 0)
+  // of every platform, with CPU devices partitioned into sub-devices of
+  // cpu_split compute units if given (and supported)
+  {
+    std::vector<cl::Device> devices;
+    std::vector<cl::Platform> platforms;
+    cl::Platform::get(&platforms);
+    for (auto &platform : platforms) {
+      std::vector<cl::Device> found;
+      platform.getDevices(CL_DEVICE_TYPE_ALL, &found);
+      for (auto &device : found) {
+        std::vector<cl::Device> sub;
+        cl_device_partition_property props[] = {CL_DEVICE_PARTITION_EQUALLY,
+                                                cpu_split, 0};
+        if (cpu_split > 0 &&
+            (device.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU) &&
+            (int)device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() > cpu_split &&
+            device.createSubDevices(props, &sub) == CL_SUCCESS)
+          devices.insert(devices.end(), sub.begin(), sub.end());
+        else
+          devices.push_back(device);
+      }
+    }
+    return devices;
+  }
+
   bool load_kernels(std::vector<std::string> source_files,
                     std::vector<std::string> kernel_names,
                     std::string build_options = "",
                     std::string re_find = "", // for modification at runtime
-                    std::string re_replace = "")
-  // based on
-  // https://github.com/Dakkers/OpenCL-examples/blob/master/example01/main.cpp
-  {
-    cl::Program::Sources
-        sources; // cannot actually push_back multiple sources to this?
+                    std::string re_replace = "") {
+    return load_source(read_sources(source_files, re_find, re_replace),
+                       kernel_names, build_options);
+  }
 
+  static std::string read_sources(std::vector<std::string> source_files,
+                                  std::string re_find = "",
+                                  std::string re_replace = "")
+  // concatenated, with re_find replaced in each if re_replace is given
+  {
     std::string kernel_code = "";
     for (auto source_file : source_files) {
       // https://stackoverflow.com/a/62772405
@@ -238,6 +389,24 @@ public:
             std::regex_replace(buffer.str(), std::regex(re_find), re_replace);
       }
     }
+    return kernel_code;
+  }
+
+  struct Build {
+    cl::Program program;
+    bool ok = false;
+    bool from_cache = false;
+    std::string log = ""; // build log if it failed
+  };
+
+  Build build_program(std::string kernel_code, std::string build_options)
+  // only reads the context, device and settings, so that it can run on a
+  // background thread while the current kernels are still in use
+  // based on
+  // https://github.com/Dakkers/OpenCL-examples/blob/master/example01/main.cpp
+  {
+    cl::Program::Sources
+        sources; // cannot actually push_back multiple sources to this?
     sources.push_back({kernel_code.c_str(), kernel_code.length()});
 
     if (_verbose) {
@@ -247,28 +416,172 @@ public:
                 << kernel_code;
     }
 
-    cl::Program program(context, sources);
-    if (program.build({device}, build_options.c_str()) != CL_SUCCESS) {
-      cl_error = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
-      return false;
+    std::string cache_file = "";
+    if (binary_cache_dir != "") {
+      std::stringstream name;
+      name << std::hex
+           << fnv1a(kernel_code + '\0' + build_options + '\0' +
+                    device.getInfo<CL_DEVICE_NAME>() + '\0' +
+                    device.getInfo<CL_DEVICE_VERSION>() + '\0' +
+                    device.getInfo<CL_DRIVER_VERSION>())
+           << ".bin";
+      cache_file =
+          (std::filesystem::path(binary_cache_dir) / name.str()).string();
     }
 
+    Build b;
+    b.from_cache = cache_file != "" &&
+                   load_binary(cache_file, build_options, b.program);
+    if (!b.from_cache) {
+      b.program = cl::Program(context, sources);
+      if (b.program.build({device}, build_options.c_str()) != CL_SUCCESS) {
+        b.log = b.program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
+        return b;
+      }
+      if (cache_file != "")
+        save_binary(cache_file, b.program);
+    }
+    if (_verbose && b.from_cache)
+      std::cout << "Loaded binary " << cache_file << "\n";
+
+    b.ok = true;
+    return b;
+  }
+
+  void add_program(cl::Program program, std::vector<std::string> kernel_names,
+                   std::string variant = "")
+  // makes the named kernels (as name@variant if given) come from program from
+  // now on, replacing any loaded under the same names. Kernels already queued
+  // are unaffected
+  {
     for (auto kernel_name : kernel_names) {
-      kernels[kernel_name] = cl::Kernel(program, kernel_name.c_str());
+      if (variant != "")
+        kernel_name += "@" + variant;
+      kernels.erase(kernel_name);
+      kernel_programs[kernel_name] = program;
     }
+  }
+
+  void remove_kernel(std::string kernel_name) {
+    kernels.erase(kernel_name);
+    kernel_programs.erase(kernel_name);
+  }
+
+  cl::Kernel &get_kernel(std::string kernel_name) {
+    auto it = kernels.find(kernel_name);
+    if (it != kernels.end())
+      return it->second;
+    std::string entry = kernel_name.substr(0, kernel_name.find('@'));
+    return kernels[kernel_name] =
+               cl::Kernel(kernel_programs[kernel_name], entry.c_str());
+  }
 
+  bool load_source(std::string kernel_code,
+                   std::vector<std::string> kernel_names,
+                   std::string build_options = "")
+  // builds a program from source text (e.g. generated at runtime), adding its
+  // kernels to the ones already loaded
+  {
+    Build b = build_program(kernel_code, build_options);
+    from_cache = b.from_cache;
+    if (!b.ok) {
+      cl_error = b.log;
+      return false;
+    }
+    add_program(b.program, kernel_names);
     return true;
   }
 
-  template <typename... ASArrays>
+  void set_profiling(bool enable)
+  // recreates the queue, with CL_QUEUE_PROFILING_ENABLE if enabling
+  {
+    if (!available)
+      return;
+    queue.finish();
+    queue = cl::CommandQueue(context, device,
+                             enable ? CL_QUEUE_PROFILING_ENABLE : 0);
+    profiling = enable;
+    pending.clear();
+  }
+
+  void collect_profile()
+  // moves the events recorded since the last call into profile, up to the
+  // first that has not completed yet
+  {
+    size_t done = 0;
+    for (auto &[record, event] : pending) {
+      if (event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>(nullptr) !=
+          CL_COMPLETE)
+        break;
+      record.queued = event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+      record.start = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+      record.end = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+      profile.push_back(record);
+      done++;
+    }
+    pending.erase(pending.begin(), pending.begin() + done);
+
+    while (profile.size() > profile_capacity)
+      profile.pop_front();
+  }
+
+  void dump_trace(std::string path)
+  // profile in the Chrome trace event format (chrome://tracing, Perfetto),
+  // one track per stage
+  {
+    const char *stages[] = {"upload", "compute", "download"};
+
+    cl_ulong t0 = profile.empty() ? 0 : profile.front().queued;
+    for (auto &record : profile)
+      t0 = std::min(t0, record.queued);
+
+    std::ofstream f(path);
+    f << "{\"traceEvents\": [\n";
+    for (int stage = 0; stage < 3; stage++) {
+      f << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": "
+        << stage << ", \"args\": {\"name\": \"" << stages[stage] << "\"}},\n";
+    }
+    for (size_t k = 0; k < profile.size(); k++) {
+      ProfileRecord &r = profile[k];
+      f << "{\"name\": \"" << r.name << "\", \"cat\": \"" << stages[r.stage]
+        << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << r.stage
+        << ", \"ts\": " << (r.start - t0) / 1e3
+        << ", \"dur\": " << (r.end - r.start) / 1e3
+        << ", \"args\": {\"frame\": " << r.frame
+        << ", \"queued_us\": " << (r.queued - t0) / 1e3 << "}}"
+        << (k + 1 < profile.size() ? ",\n" : "\n");
+    }
+    f << "]}\n";
+  }
+
+  template <typename... Args>
+  std::vector<AbstractSynchronisedArray *> set_args(std::string kernel_name,
+                                                    Args &&...args)
+  // binds args in order, uploading arrays if needed, returns the arrays
+  {
+    cl::Kernel &kernel = get_kernel(kernel_name);
+    std::vector<AbstractSynchronisedArray *> arrays;
+    int n = 0;
+    (bind_arg(kernel_name, kernel, n++, arrays, args), ...);
+    return arrays;
+  }
+
+  template <typename... Args>
   void apply_kernel(std::string kernel_name,
-                    AbstractSynchronisedArray &first_arr, ASArrays &...arrs) {
+                    AbstractSynchronisedArray &first_arr, Args &&...args)
+  // args can be arrays, bound as buffers, or POD values (int, Box_t, ...)
+  // passed by value, which need no buffer or transfer. The global range is
+  // taken from first_arr
+  {
     cl::NDRange global_dims;
+    cl::NDRange local_dims = cl::NullRange;
     if (first_arr.dims.z > 1) {
       global_dims =
           cl::NDRange(first_arr.dims.x, first_arr.dims.y, first_arr.dims.z);
     } else if (first_arr.dims.y > 1) {
-      global_dims = cl::NDRange(first_arr.dims.x, first_arr.dims.y);
+      size_t x = first_arr.dims.x, y = first_arr.dims.y;
+      local_dims = local_range(kernel_name, x, y);
+      global_dims = cl::NDRange(x, y);
     } else if (first_arr.dims.x > 1) {
       global_dims = cl::NDRange(first_arr.dims.x);
     } else {
@@ -277,16 +590,337 @@ public:
       exit(1);
     }
 
-    to_gpu(queue, kernels[kernel_name], 0, first_arr, arrs...);
+    launch(kernel_name, cl::NullRange, global_dims, local_dims, true, first_arr,
+           args...);
+  }
+
+  template <typename... Args>
+  void apply_kernel_region(std::string kernel_name, Dims offset, Dims size,
+                           AbstractSynchronisedArray &first_arr,
+                           Args &&...args)
+  // as apply_kernel, but only over the 2D range of size starting at offset,
+  // the kernel then cannot use get_global_size for the array dims
+  {
+    size_t x = size.x, y = size.y;
+    cl::NDRange local_dims = local_range(kernel_name, x, y);
+    launch(kernel_name, cl::NDRange(offset.x, offset.y), cl::NDRange(x, y),
+           local_dims, true, first_arr, args...);
+  }
+
+  template <typename... Args>
+  void apply_kernel_groups(std::string kernel_name, size_t groups,
+                           size_t group_size,
+                           AbstractSynchronisedArray &first_arr,
+                           Args &&...args)
+  // a 1D launch of groups work-groups of group_size items, for kernels that
+  // stride over their arrays and reduce in local memory
+  {
+    launch(kernel_name, cl::NullRange, cl::NDRange(groups * group_size),
+           cl::NDRange(group_size), false, first_arr, args...);
+  }
+
+  size_t max_group_size(std::string kernel_name)
+  // of kernel_name on this device, at most that of the device
+  {
+    return get_kernel(kernel_name)
+        .getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+  }
+
+  template <typename... Args>
+  Dims autotune(std::string kernel_name, int reps,
+                AbstractSynchronisedArray &first_arr, Args &&...args)
+  // times reps runs of apply_kernel over first_arr's 2D range with the
+  // driver's local shape and with each candidate that fits the kernel on this
+  // device, keeping the fastest in local_shapes. Returns it, {0, 0} if the
+  // driver's was best
+  {
+    std::string base = kernel_name.substr(0, kernel_name.find('@'));
+    std::vector<Dims> candidates{{8, 8},  {4, 16}, {2, 32}, {1, 64},
+                                 {16, 4}, {32, 2}, {64, 1}, {16, 16},
+                                 {8, 32}, {4, 64}};
+    size_t max_size =
+        get_kernel(kernel_name)
+            .getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+
+    auto time = [&](int runs) {
+      queue.finish();
+      auto start = std::chrono::steady_clock::now();
+      for (int r = 0; r < runs; r++)
+        apply_kernel(kernel_name, first_arr, args...);
+      queue.finish();
+      std::chrono::duration<double, std::milli> took =
+          std::chrono::steady_clock::now() - start;
+      return took.count();
+    };
+
+    local_shapes.erase(base);
+    time(1); // warm up, e.g. creating the kernel and uploading args
+    double best_ms = time(reps);
+    Dims best = {0, 0};
+    for (Dims c : candidates) {
+      if ((size_t)(c.x * c.y) > max_size)
+        continue;
+      local_shapes[base] = c;
+      double ms = time(reps);
+      if (local_shapes.count(base) && ms < best_ms) { // else it failed
+        best_ms = ms;
+        best = c;
+      }
+    }
+    if (best.x)
+      local_shapes[base] = best;
+    else
+      local_shapes.erase(base);
+    if (_verbose)
+      std::cout << "autotune " << base << ": " << best.x << "x" << best.y
+                << ", " << best_ms / reps << " ms\n";
+    return best;
+  }
+
+  void load_tuning()
+  // this device's local_shapes from tuning_file
+  {
+    local_shapes.clear();
+    std::ifstream f(tuning_file);
+    std::string line, dev, kernel;
+    std::string name = device.getInfo<CL_DEVICE_NAME>();
+    while (std::getline(f, line)) {
+      std::stringstream ss(line);
+      Dims d;
+      if (std::getline(ss, dev, '\t') && std::getline(ss, kernel, '\t') &&
+          ss >> d.x >> d.y && dev == name)
+        local_shapes[kernel] = d;
+    }
+  }
+
+  void save_tuning()
+  // rewrites tuning_file with this device's local_shapes, keeping the lines
+  // of other devices
+  {
+    if (tuning_file == "")
+      return;
+    std::string name = device.getInfo<CL_DEVICE_NAME>();
+    std::vector<std::string> kept;
+    std::ifstream in(tuning_file);
+    std::string line;
+    while (std::getline(in, line)) {
+      if (line.substr(0, line.find('\t')) != name)
+        kept.push_back(line);
+    }
+    in.close();
+
+    std::filesystem::path path(tuning_file);
+    if (path.has_parent_path())
+      std::filesystem::create_directories(path.parent_path());
+    std::ofstream out(tuning_file);
+    for (auto &l : kept)
+      out << l << "\n";
+    for (auto &[kernel, d] : local_shapes)
+      out << name << "\t" << kernel << "\t" << d.x << "\t" << d.y << "\n";
+  }
+
+  void copy(AbstractSynchronisedArray &src, AbstractSynchronisedArray &dst)
+  // device side copy, of as much as fits in dst
+  {
+    src.to_gpu(queue);
+    cl::Event event;
+    queue.enqueueCopyBuffer(src.gpu_buff, dst.gpu_buff, 0, 0,
+                            std::min(src.buffsize, dst.buffsize), nullptr,
+                            profiling ? &event : nullptr);
+    if (profiling)
+      record("copy", Compute, event);
+    dst.mark_device_dirty();
+  }
+
+  void read(AbstractSynchronisedArray &arr, std::string name = "read")
+  // brings arr back to the host, if a kernel has written to it since
+  {
+    if (!available)
+      return;
+    cl::Event event;
+    if (arr.from_gpu(queue, profiling ? &event : nullptr) && profiling)
+      record(name, Download, event);
+  }
+
+  void read_async(AbstractSynchronisedArray &arr, void *dst, cl::Event &done,
+                  std::string name = "read")
+  // copies the device side of arr into dst (arr.buffsize bytes) without
+  // waiting, dst must stay valid until done completes. The host side of arr
+  // is left as it was
+  {
+    arr.to_gpu(queue);
+    queue.enqueueReadBuffer(arr.gpu_buff, CL_FALSE, 0, arr.buffsize, dst,
+                            nullptr, &done);
+    if (profiling)
+      record(name, Download, done);
+  }
+
+  void read_range_async(AbstractSynchronisedArray &arr, size_t offset,
+                        size_t size, void *dst, cl::Event &done,
+                        std::string name = "read")
+  // read_range without waiting, dst must stay valid until done completes
+  {
+    queue.enqueueReadBuffer(arr.gpu_buff, CL_FALSE, offset, size, dst, nullptr,
+                            &done);
+    if (profiling)
+      record(name, Download, done);
+  }
 
-    queue.enqueueNDRangeKernel(kernels[kernel_name],
-                               cl::NullRange, // offset
-                               global_dims,
-                               cl::NullRange); // local  dims (warps/workgroups)
+  void read_range(AbstractSynchronisedArray &arr, size_t offset, size_t size,
+                  void *dst, std::string name = "read")
+  // blocking copy of size bytes at offset of the device side of arr into
+  // dst, the host side of arr is left as it was
+  {
+    cl::Event event;
+    queue.enqueueReadBuffer(arr.gpu_buff, CL_TRUE, offset, size, dst, nullptr,
+                            profiling ? &event : nullptr);
+    if (profiling)
+      record(name, Download, event);
+  }
 
-    from_gpu(queue, first_arr, arrs...);
+private:
+  cl::NDRange local_range(std::string kernel_name, size_t &x, size_t &y)
+  // the tuned local shape of a 2D launch, if any, padding x and y to it
+  {
+    auto it = local_shapes.find(kernel_name.substr(0, kernel_name.find('@')));
+    if (it == local_shapes.end())
+      return cl::NullRange;
+    Dims l = it->second;
+    x = (x + l.x - 1) / l.x * l.x;
+    y = (y + l.y - 1) / l.y * l.y;
+    return cl::NDRange(l.x, l.y);
+  }
 
-    if (!no_block)
+  template <typename... Args>
+  void launch(std::string kernel_name, cl::NDRange offset,
+              cl::NDRange global_dims, cl::NDRange local_dims, bool tuned,
+              AbstractSynchronisedArray &first_arr, Args &&...args)
+  // tuned if local_dims came from local_shapes, which then fall back to the
+  // driver's if rejected. Local sizes the kernel depends on are not retried
+  {
+    std::vector<AbstractSynchronisedArray *> arrays =
+        set_args(kernel_name, first_arr, args...);
+    cl::Event event;
+    cl::Event *ev = profiling ? &event : nullptr;
+
+    launch_error =
+        queue.enqueueNDRangeKernel(get_kernel(kernel_name), offset,
+                                   global_dims, local_dims, nullptr, ev);
+    if (launch_error != CL_SUCCESS && tuned && local_dims.dimensions() > 0) {
+      // e.g. a shape tuned for another build, dropped for the driver's
+      local_shapes.erase(kernel_name.substr(0, kernel_name.find('@')));
+      launch_error =
+          queue.enqueueNDRangeKernel(get_kernel(kernel_name), offset,
+                                     global_dims, cl::NullRange, nullptr, ev);
+    }
+    if (launch_error != CL_SUCCESS)
+      std::cout << "Failed to launch " << kernel_name << " (error "
+                << launch_error << ")\n";
+    launched++;
+    if (profiling && launch_error == CL_SUCCESS)
+      record(kernel_name, Compute, event);
+
+    // results stay on the device until read
+    for (auto arr : arrays)
+      arr->mark_device_dirty();
+
+    if (!no_block) {
       queue.finish();
+      collect_profile();
+    }
+  }
+
+  static unsigned long long fnv1a(const std::string &s) {
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : s) {
+      h ^= c;
+      h *= 0x100000001b3ULL;
+    }
+    return h;
+  }
+
+  // program binary cache, see binary_cache_dir
+  bool load_binary(std::string file, std::string build_options,
+                   cl::Program &program)
+  // false if missing or rejected by the driver, e.g. after an update that
+  // kept the version string
+  {
+    std::ifstream f(file, std::ios_base::binary);
+    if (!f)
+      return false;
+    std::vector<unsigned char> binary((std::istreambuf_iterator<char>(f)),
+                                      std::istreambuf_iterator<char>());
+    if (binary.empty())
+      return false;
+
+    std::vector<cl_int> status;
+    cl_int err;
+    program = cl::Program(context, {device}, {{binary.data(), binary.size()}},
+                          &status, &err);
+    return err == CL_SUCCESS &&
+           program.build({device}, build_options.c_str()) == CL_SUCCESS;
+  }
+
+  void save_binary(std::string file, cl::Program &program) {
+    size_t size = 0;
+    if (clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, sizeof(size),
+                         &size, nullptr) != CL_SUCCESS ||
+        size == 0)
+      return;
+    std::vector<unsigned char> binary(size);
+    unsigned char *ptr = binary.data();
+    if (clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(ptr), &ptr,
+                         nullptr) != CL_SUCCESS)
+      return;
+
+    // written under a name of this process first, so that a concurrent run
+    // never reads a partial file nor writes into the same temporary
+    std::error_code ec;
+    std::filesystem::create_directories(binary_cache_dir, ec);
+#ifdef _WIN32
+    int pid = _getpid();
+#else
+    int pid = getpid();
+#endif
+    std::stringstream tmp;
+    tmp << file << "." << pid << "." << std::hex << std::random_device()()
+        << ".tmp";
+    bool written;
+    {
+      std::ofstream f(tmp.str(), std::ios_base::binary);
+      f.write((char *)binary.data(), size);
+      written = bool(f);
+    }
+    if (written)
+      std::filesystem::rename(tmp.str(), file, ec);
+    if (!written || ec)
+      std::filesystem::remove(tmp.str(), ec);
+  }
+
+  // events not yet known to have completed
+  std::vector<std::pair<ProfileRecord, cl::Event>> pending;
+
+  void record(std::string name, int stage, cl::Event &event) {
+    pending.push_back({{name, stage, profile_frame, 0, 0, 0}, event});
+  }
+
+  void bind_arg(std::string kernel_name, cl::Kernel &kernel, int n,
+                std::vector<AbstractSynchronisedArray *> &arrays,
+                AbstractSynchronisedArray &arr) {
+    cl::Event event;
+    if (arr.to_gpu(queue, profiling ? &event : nullptr) && profiling)
+      record(kernel_name + " arg " + std::to_string(n), Upload, event);
+    kernel.setArg(n, arr.gpu_buff);
+    arrays.push_back(&arr);
+  }
+
+  template <typename T>
+    requires(!std::is_base_of_v<AbstractSynchronisedArray, T>)
+  void bind_arg(std::string kernel_name, cl::Kernel &kernel, int n,
+                std::vector<AbstractSynchronisedArray *> &arrays,
+                const T &value) {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "by value kernel arguments must be plain structs/scalars");
+    kernel.setArg(n, sizeof(T), &value);
   }
 };
@@ -0,0 +1,1294 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <regex>
+#include <sstream>
+namespace fs = std::filesystem;
+
+#include "fractal_compute.hpp"
+
+FractalCompute::FractalCompute(int N, int M, bool verbose)
+    : ecl(verbose), images(ecl.context) {
+  this->N = N;
+  this->M = M;
+
+  ecl.binary_cache_dir = ".clcache";
+  ecl.tuning_file = ".clcache/workgroups.tsv";
+  if (ecl.available) {
+    compile_kernels("");
+    ecl.load_tuning();
+  } else {
+    backend = ComputeBackend::CPU;
+  }
+  ecl.no_block = true;
+
+  param = new SynchronisedArray<FParam>(ecl.context, CL_MEM_READ_ONLY, {1});
+  pass_param =
+      new SynchronisedArray<FParam>(ecl.context, CL_MEM_READ_ONLY, {1});
+  deep_param =
+      new SynchronisedArray<DeepParam>(ecl.context, CL_MEM_READ_ONLY, {1});
+  ref_orbit =
+      new SynchronisedArray<Complex>(ecl.context, CL_MEM_READ_ONLY, {1});
+  early = new SynchronisedArray<int>(ecl.context, {1});
+  (*early)[0] = 0;
+  stats = new SynchronisedArray<FieldStats>(ecl.context, {3});
+  cdf = new SynchronisedArray<float>(ecl.context, {3 * HIST_BINS});
+  reduce_part = new SynchronisedArray<FPN>(ecl.context, {2 * reduce_groups});
+  hist = new SynchronisedArray<int>(ecl.context, {HIST_BINS + 2});
+
+  alloc_buffers();
+}
+
+FractalCompute::~FractalCompute() {
+  free_buffers();
+  free_stale(true);
+  delete param;
+  delete pass_param;
+  delete deep_param;
+  delete ref_orbit;
+  delete early;
+  delete stats;
+  delete cdf;
+  delete reduce_part;
+  delete hist;
+  delete multi;
+}
+
+void FractalCompute::alloc_buffers() {
+  field1 = new SynchronisedArray<FPN>(ecl.context, {N, M});
+  field2 = new SynchronisedArray<FPN>(ecl.context, {N, M});
+  field3 = new SynchronisedArray<FPN>(ecl.context, {N, M});
+  pix = new SynchronisedArray<Pixel>(ecl.context, {N, M});
+  glitch = new SynchronisedArray<int>(ecl.context, {N, M});
+  scratch = new SynchronisedArray<FPN>(ecl.context, {N, M});
+  // the finest flag grid is that of the ms_min / 2 tiles
+  int h = ms_min / 2;
+  for (int k = 0; k < 2; k++)
+    ms_active[k] = new SynchronisedArray<int>(
+        ecl.context, {((N + h - 1) / h) * ((M + h - 1) / h)});
+  for (auto &slot : slots)
+    slot.pixels = new Pixel[N * M];
+  computed.clear();
+}
+
+void FractalCompute::free_buffers() {
+  delete pix;
+  delete field1;
+  delete field2;
+  delete field3;
+  delete glitch;
+  delete scratch;
+  delete ms_active[0];
+  delete ms_active[1];
+  if (!in_flight.empty()) // reads into the slots
+    ecl.queue.finish();
+  in_flight.clear();
+  shown = -1;
+  for (auto &slot : slots)
+    delete[] slot.pixels;
+}
+
+void FractalCompute::resize(int N, int M) {
+  if (N == this->N && M == this->M)
+    return;
+
+  // device buffers are only released once the queued jobs using them are
+  // done, the host side reads are kept until then
+  for (int k : in_flight) {
+    stale.push_back(slots[k]);
+    slots[k].pixels = nullptr;
+    slots[k].done = nullptr;
+  }
+  in_flight.clear();
+  free_buffers();
+  this->N = N;
+  this->M = M;
+  alloc_buffers();
+}
+
+void FractalCompute::update_params() {
+  FParam p;
+  memset(&p, 0, sizeof(p)); // padding too, update compares bytes
+  p.mandel = mandel ? 1 : 0;
+  p.c = {(FPN)cre, (FPN)cim};
+  p.view_rect = {viewport_center.re - viewport_deltas.re,
+                 viewport_center.re + viewport_deltas.re,
+                 viewport_center.im - viewport_deltas.im,
+                 viewport_center.im + viewport_deltas.im};
+  p.MAXITER = MAXITER;
+  p.dims = {N, M};
+  p.step = 1;
+  p.interior = interior;
+  if (!mandel || !(default_func || backend == ComputeBackend::CPU))
+    p.interior &= ~INTERIOR_BULBS;
+  param->update(&p);
+}
+
+void FractalCompute::read_frame() { ecl.read(*pix, "pix"); }
+
+static bool same_field(FieldUIState &a, FieldUIState &b) {
+  if (a.field != b.field)
+    return false;
+  if (a.field == 1)
+    return a.proxtype == b.proxtype;
+  if (a.field == 2)
+    return a.real == b.real && a.box_bot == b.box_bot &&
+           a.box_top == b.box_top && a.box_left == b.box_left &&
+           a.box_right == b.box_right;
+  return true;
+}
+
+bool FractalCompute::pan_offset(FieldContents &prev, FieldContents &now,
+                                int &di, int &dj)
+// whether now is prev moved by a whole number of pixels (di rows, dj cols)
+{
+  FParam_t &a = prev.param, &b = now.param;
+  if (!prev.valid || prev.backend != now.backend ||
+      !same_field(prev.state, now.state) || a.mandel != b.mandel ||
+      a.c.re != b.c.re || a.c.im != b.c.im || a.MAXITER != b.MAXITER ||
+      a.dims.imH != b.dims.imH || a.dims.imW != b.dims.imW)
+    return false;
+
+  FPN wa = a.view_rect.right - a.view_rect.left;
+  FPN ha = a.view_rect.top - a.view_rect.bot;
+  FPN wb = b.view_rect.right - b.view_rect.left;
+  FPN hb = b.view_rect.top - b.view_rect.bot;
+  if (abs(wa - wb) > 1e-6 * wa || abs(ha - hb) > 1e-6 * ha)
+    return false; // zoomed
+
+  FPN fj = (b.view_rect.left - a.view_rect.left) / (wa / M);
+  FPN fi = (b.view_rect.bot - a.view_rect.bot) / (ha / N);
+  dj = (int)round(fj);
+  di = (int)round(fi);
+  return abs(fj - dj) < 1e-3 && abs(fi - di) < 1e-3;
+}
+
+static void launch_field(EasyCL &ecl, SynchronisedArray<FPN> &field,
+                         FieldUIState &state, Tile r,
+                         SynchronisedArray<FParam> &p,
+                         SynchronisedArray<int> &early,
+                         int precision = Precision::Native,
+                         const DFParam_t &view = {})
+// r is in work items, which are pixels unless p has a step, view is only used
+// by the double-float kernels
+{
+  int n = r.i1 - r.i0, m = r.j1 - r.j0;
+  if (n <= 0 || m <= 0)
+    return;
+
+  Box trap = {state.box_bot, state.box_top, state.box_left, state.box_right};
+  string trap_kernel = state.real ? "orbit_trap_re" : "orbit_trap_im";
+  if (precision == Precision::DoubleFloat) {
+    trap_kernel = state.real ? "orbit_trap_df_re" : "orbit_trap_df_im";
+    switch (state.field) {
+    case 0:
+      ecl.apply_kernel_region("escape_iter_df", {r.i0, r.j0}, {n, m}, field,
+                              p, early, view);
+      break;
+    case 1:
+      ecl.apply_kernel_region("min_prox_df", {r.i0, r.j0}, {n, m}, field, p,
+                              early, view, state.proxtype);
+      break;
+    case 2:
+      ecl.apply_kernel_region(trap_kernel, {r.i0, r.j0}, {n, m}, field, p,
+                              early, view, trap);
+      break;
+    }
+    return;
+  }
+
+  bool f32 = precision == Precision::Single;
+  if (f32)
+    trap_kernel = state.real ? "orbit_trap_f32_re" : "orbit_trap_f32_im";
+  switch (state.field) {
+  case 0:
+    ecl.apply_kernel_region(f32 ? "escape_iter_f32" : "escape_iter_fpn",
+                            {r.i0, r.j0}, {n, m}, field, p, early);
+    break;
+  case 1:
+    ecl.apply_kernel_region(f32 ? "min_prox_f32" : "min_prox", {r.i0, r.j0},
+                            {n, m}, field, p, early, state.proxtype);
+    break;
+  case 2:
+    ecl.apply_kernel_region(trap_kernel, {r.i0, r.j0}, {n, m}, field, p,
+                            early, trap);
+    break;
+  }
+}
+
+const char *precision_name(int precision) {
+  if (precision == Precision::DoubleFloat)
+    return "double-float";
+  if (precision == Precision::Auto)
+    return "auto";
+  if (precision == Precision::Single || sizeof(FPN) == sizeof(float))
+    return "float";
+  return "double";
+}
+
+int FractalCompute::frame_precision() {
+  bool opencl = backend == ComputeBackend::OpenCL;
+  // the other kernels ignore edited functions, the CPU backend has none
+  if (deep_zoom || (opencl && !default_func))
+    return Precision::Native;
+  if (precision == Precision::Single)
+    return opencl ? precision : Precision::Native;
+  if (precision != Precision::Auto)
+    return precision;
+
+  // rounding error of the orbits, relative to |z| which is up to 2
+  FPN size = max((FPN)1, abs(viewport_center.re) + abs(viewport_center.im));
+  bool coarse = 2 * viewport_deltas.re / M >
+                1e3 * numeric_limits<float>::epsilon() * size;
+#ifdef USE_FLOAT
+  return coarse ? Precision::Native : Precision::DoubleFloat;
+#else
+  return coarse && opencl ? Precision::Single : Precision::Native;
+#endif
+}
+
+DFParam_t FractalCompute::df_view() {
+  return deep.df_map(param->cpu_buff[0], viewport_deltas, N, M);
+}
+
+void FractalCompute::field_region(SynchronisedArray<FPN> *field,
+                                  FieldUIState *state, Tile r,
+                                  SynchronisedArray<FParam> &p) {
+  int prec = frame_precision();
+  launch_field(ecl, *field, *state, r, p, *early, prec,
+               prec == Precision::DoubleFloat ? df_view() : DFParam_t{});
+}
+
+void FractalCompute::multi_field(SynchronisedArray<FPN> *field,
+                                 FieldUIState *state) {
+  if (!multi || multi->cpu_split != cpu_split) {
+    delete multi;
+    multi = new MultiDevice(ecl, cpu_split);
+    multi->set_program(kernel_source, build_options);
+  }
+
+  FieldUIState s = *state;
+  int prec = frame_precision();
+  DFParam_t view = prec == Precision::DoubleFloat ? df_view() : DFParam_t{};
+  // counted on the host, as for the CPU backend
+  cpu.early_exits += multi->compute(
+      field->cpu_buff, param->cpu_buff[0], N, M,
+      [&](EasyCL &e, SynchronisedArray<FPN> &f, SynchronisedArray<FParam> &p,
+          SynchronisedArray<int> &early, Tile r) {
+        launch_field(e, f, s, r, p, early, prec, view);
+      });
+  field->mark_host_dirty();
+}
+
+void FractalCompute::shift_field(SynchronisedArray<FPN> *field,
+                                 FieldUIState *state, int di, int dj)
+// moves the pixels that are still in view into place, on the device, then
+// computes the exposed L shaped border (rows first, then the remaining cols)
+{
+  ecl.apply_kernel("shift_field", *scratch, *field, di, dj);
+  ecl.copy(*scratch, *field);
+
+  Tile rows = di > 0 ? Tile{N - di, 0, N, M} : Tile{0, 0, -di, M};
+  field_region(field, state, rows, *param);
+
+  int i0 = di > 0 ? 0 : -di, i1 = di > 0 ? N - di : N;
+  Tile cols = dj > 0 ? Tile{i0, M - dj, i1, M} : Tile{i0, 0, i1, -dj};
+  field_region(field, state, cols, *param);
+}
+
+void FractalCompute::progressive_pass(SynchronisedArray<FPN> *field,
+                                      FieldUIState *state, int step, int skip)
+// computes every step-th pixel, except those on the skip grid, then spreads
+// them over their blocks for display
+{
+  FParam_t p = param->cpu_buff[0];
+  p.step = step;
+  p.skip = skip;
+  pass_param->update(&p);
+
+  Tile grid = {0, 0, (N + step - 1) / step, (M + step - 1) / step};
+  field_region(field, state, grid, *pass_param);
+  if (step > 1)
+    ecl.apply_kernel("fill_blocks", *field, step);
+}
+
+void FractalCompute::compute_field(SynchronisedArray<FPN> *field,
+                                   FieldUIState *state) {
+  if (!compute_enabled)
+    return;
+
+  FieldContents &prev = computed[field];
+  FieldContents now = {true, backend, param->cpu_buff[0], *state, 1};
+  now.precision = frame_precision();
+  if (now.precision == Precision::DoubleFloat)
+    now.view = df_view();
+  precision_used = now.precision;
+
+  if (deep_zoom) {
+    prev.valid = false; // has its own caching
+  } else {
+    int di, dj;
+    bool moved = pan_offset(prev, now, di, dj) && abs(di) < N && abs(dj) < M;
+    if (prev.precision != now.precision)
+      moved = false;
+    else if (now.precision == Precision::DoubleFloat) // finer than view_rect
+      moved = moved && di == 0 && dj == 0 &&
+              memcmp(&prev.view, &now.view, sizeof(DFParam_t)) == 0;
+    bool unchanged = moved && di == 0 && dj == 0;
+    bool opencl = backend == ComputeBackend::OpenCL;
+    int done_step = prev.step;
+    prev = now;
+
+    if (progressive && opencl) {
+      if (unchanged && done_step > 1) { // next pass
+        progressive_pass(field, state, done_step / 2, done_step);
+        prev.step = done_step / 2;
+        return;
+      }
+      if (unchanged)
+        return;
+      if (!(reuse_fields && moved && done_step == 1)) { // restart
+        progressive_pass(field, state, coarsest_step, 0);
+        prev.step = coarsest_step;
+        return;
+      }
+    }
+
+    if (reuse_fields && unchanged && done_step == 1)
+      return;
+    if (reuse_fields && moved && done_step == 1 && opencl) {
+      shift_field(field, state, di, dj);
+      return;
+    }
+  }
+
+  full_frame = true;
+  if (multi_device && backend == ComputeBackend::OpenCL && !deep_zoom) {
+    multi_field(field, state);
+    return;
+  }
+
+  switch (state->field) {
+  case 0:
+    escape_iter(field);
+    break;
+  case 1:
+    min_prox(field, state->proxtype);
+    break;
+  case 2:
+    orbit_trap(field, state->box_bot, state->box_top, state->box_left,
+               state->box_right, state->real);
+    break;
+  }
+}
+
+static bool same_box(FieldUIState &a, FieldUIState &b) {
+  return a.box_bot == b.box_bot && a.box_top == b.box_top &&
+         a.box_left == b.box_left && a.box_right == b.box_right;
+}
+
+static string fused_name(vector<FieldUIState *> &states, string output,
+                         vector<int> &slot)
+// slot[k] is the trap (argument) used by trap field k, that of the first
+// field with the same box, so that U/V pairs search the orbit once
+{
+  string name = "fused";
+  for (size_t k = 0; k < states.size(); k++) {
+    slot.push_back(k);
+    switch (states[k]->field) {
+    case 0:
+      name += "_i";
+      break;
+    case 1:
+      name += "_p";
+      break;
+    case 2:
+      for (size_t l = 0; l < k; l++) {
+        if (states[l]->field == 2 && same_box(*states[l], *states[k])) {
+          slot[k] = l;
+          break;
+        }
+      }
+      name += "_t" + to_string(slot[k]) + (states[k]->real ? "r" : "i");
+      break;
+    }
+  }
+  if (output != "")
+    name += "_" + output;
+  return name;
+}
+
+static string fused_source(string name, vector<FieldUIState *> &states,
+                           vector<int> &slot, string output)
+// A single loop doing the work of _escape_iter, _minprox and _orbit_trap for
+// the given fields, with the same results. All fused kernels take the same
+// arguments, ignoring those they do not need:
+//   res0, res1, res2, param, early, PROXTYPE0-2, trap0-2, sim, mim, dims
+// where PROXTYPEk/trapk are those of field k, and sim/mim/dims are those of
+// map_img2 (mim being the output of pack too)
+{
+  int n = states.size();
+  bool bounded = false; // fields that stop once the orbit escapes
+  bool iters = false;     // fields taking the bulb test of _escape_iter
+  bool iters_only = true; // so that the loop can be skipped on a hit
+  vector<int> traps;
+  for (int k = 0; k < n; k++) {
+    bounded |= states[k]->field != 2;
+    iters |= states[k]->field == 0;
+    iters_only &= states[k]->field == 0;
+    if (states[k]->field == 2 && slot[k] == k)
+      traps.push_back(k);
+  }
+
+  stringstream src;
+  src << "\n__kernel void " << name
+      << "(__global FPN *res0_g,\n"
+         "    __global FPN *res1_g,\n"
+         "    __global FPN *res2_g,\n"
+         "    __global FParam_t *param,\n"
+         "    __global int *early_g,\n"
+         "    int PROXTYPE0, int PROXTYPE1, int PROXTYPE2,\n"
+         "    Box_t trap0, Box_t trap1, Box_t trap2,\n"
+         "    __global Pixel_t *sim_g,\n"
+         "    __global Pixel_t *mim_g,\n"
+         "    ImDims_t dims)\n"
+         "{\n"
+         "    __local int group_early;\n"
+         "    early_begin(&group_early);\n\n"
+         "    int N = param->dims.imH;\n"
+         "    int M = param->dims.imW;\n"
+         "    int i, j, early = 0;\n"
+         "    if (pixel_of(param, &i, &j)) {\n";
+
+  // per pixel, indented into the pixel_of branch
+  stringstream body;
+  body << "    Complex_t p = {param->view_rect.left + "
+          "j*(param->view_rect.right-param->view_rect.left)/M,\n"
+          "                   param->view_rect.bot  + "
+          "i*(param->view_rect.top  -param->view_rect.bot )/N};\n"
+          "    Complex_t _c = param->mandel ? p : param->c;\n"
+          "    int bulb = "
+       << (iters ? "(param->interior & INTERIOR_BULBS) && in_main_bulbs(_c)"
+                 : "0")
+       << ";\n"
+          "    early = bulb;\n\n"
+          "    Complex_t z = p;\n"
+          "    Period_t period = period_start(z);\n"
+          "    int n = "
+       << (iters_only ? "bulb ? param->MAXITER : 0" : "0")
+       << ";\n"
+          "    int bounded = "
+       << bounded << ";\n    int iters = 0;\n";
+  for (int k = 0; k < n; k++) {
+    if (states[k]->field == 1)
+      body << "    FPN dist" << k << " = proximity(z, PROXTYPE" << k << ");\n";
+  }
+  for (int t : traps) {
+    body << "    int hit" << t << " = 0;\n"
+         << "    Complex_t uv" << t << " = {FZERO, FZERO};\n";
+  }
+
+  body << "\n    while (n < param->MAXITER) {\n"
+          "        if (bounded && !in_bounds(z)) {\n"
+          "            bounded = 0;\n"
+          "            iters = n;\n"
+          "        }\n"
+          "        if (!bounded";
+  for (int t : traps)
+    body << " && hit" << t;
+  body << ")\n"
+          "            break;\n"
+          "        z = f(z, _c);\n"
+          "        n += 1;\n";
+  for (int k = 0; k < n; k++) {
+    if (states[k]->field == 1)
+      body << "        if (bounded)\n            dist" << k << " = _min(dist"
+           << k << ", proximity(z, PROXTYPE" << k << "));\n";
+  }
+  for (int t : traps) {
+    body << "        if (!hit" << t << " && in_box(z, trap" << t << ")) {\n"
+         << "            hit" << t << " = 1;\n"
+         << "            uv" << t << " = trap_uv(z, trap" << t << ");\n"
+         << "        }\n";
+  }
+  body << "        if ((param->interior & INTERIOR_PERIOD) && "
+          "period_found(&period, z)) {\n"
+          "            early = 1;\n"
+          "            break;\n"
+          "        }\n"
+          "    }\n"
+          "    if (bounded || bulb)\n"
+          "        iters = param->MAXITER;\n\n";
+
+  for (int k = 0; k < n; k++) {
+    body << "    FPN v" << k << " = ";
+    switch (states[k]->field) {
+    case 0:
+      body << "((FPN) iters)/((FPN) param->MAXITER);\n";
+      break;
+    case 1:
+      body << "dist" << k << ";\n";
+      break;
+    case 2:
+      body << "uv" << slot[k] << (states[k]->real ? ".re" : ".im") << ";\n";
+      break;
+    }
+    body << "    res" << k << "_g[i*M+j] = v" << k << ";\n";
+  }
+
+  if (output == "pack") {
+    body << "    mim_g[i*M+j] = (Pixel_t){255*v0, 255*v1, 255*v2};\n";
+  } else if (output == "pack_norm") {
+    body << "    FPN s = v0+v1+v2;\n"
+            "    mim_g[i*M+j] = (Pixel_t){255*v0/s, 255*v1/s, 255*v2/s};\n";
+  } else if (output == "map_img2") {
+    body << "    int _i = (int) ( ((float) (dims.imH-1)) * v0 );\n"
+            "    int _j = (int) ( ((float) (dims.imW-1)) * v1 );\n"
+            "    mim_g[i*M+j] = sim_g[_i*dims.imW + _j];\n";
+  }
+  string line;
+  while (getline(body, line))
+    src << (line == "" ? "" : "    ") << line << "\n";
+  src << "    }\n"
+         "    early_done(&group_early, early_g, early);\n"
+         "}\n";
+  return src.str();
+}
+
+string FractalCompute::fused_kernel(vector<FieldUIState *> states,
+                                    string output) {
+  vector<int> slot;
+  string name = fused_name(states, output, slot);
+  if (!fused_built.count(name)) {
+    string code = kernel_source + fused_source(name, states, slot, output);
+    fused_built[name] = ecl.load_source(code, {name}, build_options);
+  }
+  return fused_built[name] ? name : "";
+}
+
+bool FractalCompute::compute_fields(vector<SynchronisedArray<FPN> *> fields,
+                                    vector<FieldUIState *> states,
+                                    string output, string img_file) {
+  bool fusable = compute_enabled && fuse_fields && !deep_zoom &&
+                 !progressive && !multi_device &&
+                 frame_precision() == Precision::Native &&
+                 backend == ComputeBackend::OpenCL;
+
+  // fields that are unchanged or only panned are cheaper through compute_field
+  vector<int> full;
+  for (size_t k = 0; k < fields.size(); k++) {
+    FieldContents now = {true, backend, param->cpu_buff[0], *states[k], 1};
+    FieldContents &prev = computed[fields[k]];
+    int di, dj;
+    bool moved = pan_offset(prev, now, di, dj) && abs(di) < N && abs(dj) < M;
+    if (!(fusable && reuse_fields && moved && prev.step == 1))
+      full.push_back(k);
+  }
+
+  if (tone != TONE_FIXED)
+    output = ""; // needs the stats of the whole fields first
+
+  SynchronisedArray<Pixel> *img = nullptr;
+  if (output == "map_img2") {
+    img = images.get(img_file, wait_for_images);
+    if (!img)
+      output = ""; // not decoded yet
+  }
+
+  string kernel = "";
+  bool all = full.size() == fields.size();
+  if (fusable && full.size() > 1) {
+    vector<FieldUIState *> fs;
+    for (int k : full)
+      fs.push_back(states[k]);
+    kernel = fused_kernel(fs, all ? output : "");
+  }
+  if (kernel == "") {
+    for (size_t k = 0; k < fields.size(); k++)
+      compute_field(fields[k], states[k]);
+    return false;
+  }
+
+  for (size_t k = 0; k < fields.size(); k++) {
+    if (find(full.begin(), full.end(), k) == full.end())
+      compute_field(fields[k], states[k]);
+  }
+
+  SynchronisedArray<FPN> *res[3];
+  int proxtype[3] = {1, 1, 1};
+  Box trap[3] = {};
+  for (int m = 0; m < 3; m++) {
+    res[m] = scratch; // unused slot
+    if (m >= (int)full.size())
+      continue;
+    FieldUIState *state = states[full[m]];
+    res[m] = fields[full[m]];
+    proxtype[m] = state->proxtype;
+    trap[m] = {state->box_bot, state->box_top, state->box_left,
+               state->box_right}; // as in field_region
+    computed[res[m]] = {true, backend, param->cpu_buff[0], *state, 1};
+  }
+  precision_used = Precision::Native;
+  full_frame = true;
+
+  ImDims dims = {1, 1};
+  if (img)
+    dims = {img->dims.x, img->dims.y};
+
+  ecl.apply_kernel(kernel, *res[0], *res[1], *res[2], *param, *early,
+                   proxtype[0], proxtype[1], proxtype[2], trap[0], trap[1],
+                   trap[2], img ? *img : *pix, *pix, dims);
+  return all && output != "";
+}
+
+static const vector<string> kernel_names{
+    "escape_iter",   "escape_iter_fpn", "min_prox", "orbit_trap",
+    "orbit_trap_re", "orbit_trap_im",   "map_img",  "map_img2",
+    "apply_log_int", "apply_log_fpn",   "pack",     "pack_norm",
+    "map_sines",     "escape_iter_pert", "min_prox_pert",
+    "orbit_trap_pert_re", "orbit_trap_pert_im", "shift_field",
+    "fill_blocks",   "ms_border",       "ms_check", "ms_rest",
+    "escape_iter_df", "min_prox_df", "orbit_trap_df_re", "orbit_trap_df_im",
+    "escape_iter_f32", "min_prox_f32", "orbit_trap_f32_re",
+    "orbit_trap_f32_im", "field_minmax", "stats_range", "field_hist",
+    "hist_cdf",      "map_sines_tone", "map_img2_tone", "pack_tone"};
+
+FractalCompute::KernelBuild FractalCompute::build_kernels(string new_func) {
+  vector<string> source_files{"mandelstructs.h", "mandelutils.c", "mandel.cl"};
+  KernelBuild b;
+  b.func = new_func;
+  b.options = "-I " + string(fs::current_path()) + " -D EXTERNAL_CONCAT";
+#ifdef USE_FLOAT
+  b.options += " -D USE_FLOAT";
+#endif
+  b.source = EasyCL::read_sources(source_files, "//>>(.|\n)*?//<<", new_func);
+  b.build = ecl.build_program(b.source, b.options);
+  return b;
+}
+
+static int common_power(const string &func)
+// the exponent of every complex_pow call in func if all are the same integer
+// literal, else 0. Calls whose first argument has parentheses do not match, so
+// nested ones, e.g. complex_pow(complex_pow(z, 2), 3), leave calls unmatched
+{
+  regex call("complex_pow\\s*\\(");
+  regex literal_call("complex_pow\\s*\\([^,()]*,\\s*([0-9]{1,9})\\s*\\)");
+  int calls = distance(sregex_iterator(func.begin(), func.end(), call),
+                       sregex_iterator());
+  int power = 0, matched = 0;
+  for (sregex_iterator m(func.begin(), func.end(), literal_call), end; m != end;
+       m++, matched++) {
+    int n = stoi((*m)[1]);
+    if (power && n != power)
+      return 0;
+    power = n;
+  }
+  return matched == calls ? power : 0;
+}
+
+bool FractalCompute::install_kernels(KernelBuild &b) {
+  build_ok = b.build.ok;
+  if (!b.build.ok) { // keeping the last good program
+    ecl.cl_error = b.build.log;
+    return false;
+  }
+  ecl.cl_error = "";
+  ecl.add_program(b.build.program, kernel_names);
+
+  computed.clear();
+  default_func = b.func == "" || b.func == default_recurse_func;
+  installed_func = default_func ? "" : b.func;
+  kernel_source = b.source;
+  build_options = b.options;
+  for (auto &[name, built] : fused_built) // were built on the old function
+    ecl.remove_kernel(name);
+  fused_built.clear();
+  if (multi)
+    multi->set_program(kernel_source, build_options);
+
+  drop_variants();
+  program_gen++;
+  spec_power = common_power(default_func ? default_recurse_func : b.func);
+  return true;
+}
+
+// the kernels spec_kernel hands out variants of
+static const vector<string> spec_names{
+    "escape_iter_fpn",  "min_prox",          "orbit_trap_re",
+    "orbit_trap_im",    "escape_iter_f32",   "min_prox_f32",
+    "orbit_trap_f32_re", "orbit_trap_f32_im", "escape_iter_df",
+    "min_prox_df",      "orbit_trap_df_re",  "orbit_trap_df_im"};
+
+string FractalCompute::spec_kernel(string name, int PROXTYPE) {
+  variant_used = "";
+  if (!specialize || backend != ComputeBackend::OpenCL)
+    return name;
+
+  FParam_t &p = param->cpu_buff[0];
+  // bucketed, so that dragging the MAXITER slider reuses a few variants
+  int bound = 1;
+  while (bound < p.MAXITER && bound < (1 << 30))
+    bound *= 2;
+  string key = "m" + to_string(p.mandel) + "_i" + to_string(bound);
+  if (PROXTYPE >= 0)
+    key += "_x" + to_string(PROXTYPE);
+
+  poll_variant(false);
+  auto it = find(variants.begin(), variants.end(), key);
+  if (it == variants.end()) {
+    if (variant_build.valid() && wait_for_variants)
+      poll_variant(true);
+    if (!variant_build.valid()) { // one at a time, settings change in bursts
+      string options = build_options + " -D SPEC_MANDEL=" +
+                       to_string(p.mandel) +
+                       " -D SPEC_MAXITER_BOUND=" + to_string(bound);
+      if (PROXTYPE >= 0)
+        options += " -D SPEC_PROXTYPE=" + to_string(PROXTYPE);
+      if (spec_power)
+        options += " -D SPEC_POWER=" + to_string(spec_power);
+      variant_key = key;
+      variant_gen = program_gen;
+      variant_build = async(launch::async, &EasyCL::build_program, &ecl,
+                            kernel_source, options);
+      if (wait_for_variants)
+        poll_variant(true);
+    }
+    it = find(variants.begin(), variants.end(), key);
+    if (it == variants.end())
+      return name;
+  }
+
+  variants.splice(variants.end(), variants, it); // most recently used
+  if (!variant_ok[key])
+    return name;
+  variant_used = key;
+  return name + "@" + key;
+}
+
+void FractalCompute::poll_variant(bool wait) {
+  if (!variant_build.valid() ||
+      (!wait && variant_build.wait_for(chrono::seconds(0)) !=
+                    future_status::ready))
+    return;
+
+  auto start = chrono::steady_clock::now();
+  EasyCL::Build b = variant_build.get();
+  chrono::duration<double, milli> waited = chrono::steady_clock::now() - start;
+  variant_wait_ms += waited.count();
+  if (variant_gen != program_gen) // for a previous function
+    return;
+  if (b.ok)
+    ecl.add_program(b.program, spec_names, variant_key);
+  variants.push_back(variant_key);
+  variant_ok[variant_key] = b.ok;
+
+  while ((int)variants.size() > max_variants) {
+    string old = variants.front();
+    for (auto &name : spec_names)
+      ecl.remove_kernel(name + "@" + old);
+    variant_ok.erase(old);
+    variants.pop_front();
+  }
+}
+
+void FractalCompute::autotune(int reps)
+// on the current view and settings, which the timings depend on (e.g. on how
+// much of the view is in the set). The proximity and trap fields use the
+// defaults of FieldUIState
+{
+  if (!ecl.available)
+    return;
+  FieldUIState s;
+  Box trap = {s.box_bot, s.box_top, s.box_left, s.box_right};
+  DFParam_t view = df_view();
+  SynchronisedArray<FPN> &f = *field1;
+
+  ecl.autotune("escape_iter_fpn", reps, f, *param, *early);
+  ecl.autotune("min_prox", reps, f, *param, *early, s.proxtype);
+  ecl.autotune("orbit_trap_re", reps, f, *param, *early, trap);
+  ecl.autotune("orbit_trap_im", reps, f, *param, *early, trap);
+  ecl.autotune("escape_iter_f32", reps, f, *param, *early);
+  ecl.autotune("min_prox_f32", reps, f, *param, *early, s.proxtype);
+  ecl.autotune("orbit_trap_f32_re", reps, f, *param, *early, trap);
+  ecl.autotune("orbit_trap_f32_im", reps, f, *param, *early, trap);
+  ecl.autotune("escape_iter_df", reps, f, *param, *early, view);
+  ecl.autotune("min_prox_df", reps, f, *param, *early, view, s.proxtype);
+  ecl.autotune("orbit_trap_df_re", reps, f, *param, *early, view, trap);
+  ecl.autotune("orbit_trap_df_im", reps, f, *param, *early, view, trap);
+  ecl.save_tuning();
+
+  // field1 and the counter now hold the runs' results
+  computed.clear();
+  ecl.read(*early, "early");
+  (*early)[0] = 0;
+}
+
+void FractalCompute::drop_variants() {
+  for (auto &key : variants) {
+    for (auto &name : spec_names)
+      ecl.remove_kernel(name + "@" + key);
+  }
+  variants.clear();
+  variant_ok.clear();
+}
+
+bool FractalCompute::compile_kernels(string new_func) {
+  KernelBuild b = build_kernels(new_func);
+  return install_kernels(b);
+}
+
+void FractalCompute::compile_kernels_async(string new_func) {
+  if (build.valid()) { // only the latest request is kept
+    queued_func = new_func;
+    build_queued = true;
+    return;
+  }
+  build = async(launch::async, &FractalCompute::build_kernels, this, new_func);
+}
+
+bool FractalCompute::poll_compile() {
+  if (!build.valid() ||
+      build.wait_for(chrono::seconds(0)) != future_status::ready)
+    return false;
+
+  KernelBuild b = build.get();
+  if (build_queued) {
+    build_queued = false;
+    compile_kernels_async(queued_func);
+    return false; // superseded
+  }
+  install_kernels(b);
+  return true;
+}
+
+void FractalCompute::escape_iter(SynchronisedArray<FPN> *field) {
+  if (compute_enabled) {
+    if (deep_zoom) {
+      deep_field(field, 0, 0, {}, false);
+    } else if (backend == ComputeBackend::CPU) {
+      if (use_df())
+        cpu.escape_iter_df(field->cpu_buff, param->cpu_buff[0], df_view(), N,
+                           M);
+      else
+        cpu.escape_iter(field->cpu_buff, param->cpu_buff[0], N, M);
+      field->mark_host_dirty();
+    } else if (use_df()) {
+      ecl.apply_kernel(spec_kernel("escape_iter_df"), *field, *param, *early,
+                       df_view());
+    } else if (use_f32()) {
+      ecl.apply_kernel(spec_kernel("escape_iter_f32"), *field, *param, *early);
+    } else if (subdivide) {
+      mariani_silver(field);
+    } else {
+      ecl.apply_kernel(spec_kernel("escape_iter_fpn"), *field, *param, *early);
+    }
+  }
+}
+
+void FractalCompute::mariani_silver(SynchronisedArray<FPN> *field)
+// same result as escape_iter_fpn as long as a uniform tile border means a
+// uniform interior, i.e. no detail is small enough to fit inside a tile
+// without touching its border (the set being connected helps, but is no
+// guarantee at this resolution)
+{
+  SynchronisedArray<int> *active = ms_active[0], *next = ms_active[1];
+  int s = ms_tile;
+  for (; s >= ms_min; s /= 2) {
+    int first = s == ms_tile;
+    ecl.apply_kernel("ms_border", *field, *param, *early, *active, s, first);
+    ecl.apply_kernel_region("ms_check", {0, 0},
+                            {(N + s - 1) / s, (M + s - 1) / s}, *field,
+                            *param, *active, *next, s, first);
+    swap(active, next);
+  }
+  ecl.apply_kernel("ms_rest", *field, *param, *early, *active, s * 2);
+}
+
+void FractalCompute::min_prox(SynchronisedArray<FPN> *field, int PROXTYPE) {
+  if (compute_enabled) {
+    if (deep_zoom) {
+      deep_field(field, 1, PROXTYPE, {}, false);
+      return;
+    }
+
+    if (backend == ComputeBackend::CPU) {
+      if (use_df())
+        cpu.min_prox_df(field->cpu_buff, param->cpu_buff[0], df_view(),
+                        PROXTYPE, N, M);
+      else
+        cpu.min_prox(field->cpu_buff, param->cpu_buff[0], PROXTYPE, N, M);
+      field->mark_host_dirty();
+      return;
+    }
+
+    if (use_df())
+      ecl.apply_kernel(spec_kernel("min_prox_df", PROXTYPE), *field, *param,
+                       *early, df_view(), PROXTYPE);
+    else if (use_f32())
+      ecl.apply_kernel(spec_kernel("min_prox_f32", PROXTYPE), *field, *param,
+                       *early, PROXTYPE);
+    else
+      ecl.apply_kernel(spec_kernel("min_prox", PROXTYPE), *field, *param,
+                       *early, PROXTYPE);
+  }
+}
+
+void FractalCompute::orbit_trap(SynchronisedArray<FPN> *field, float bb,
+                                float bt, float bl, float br, bool real) {
+  if (compute_enabled) {
+    if (deep_zoom) {
+      deep_field(field, 2, 0, {bb, bt, bl, br}, real);
+      return;
+    }
+
+    if (backend == ComputeBackend::CPU) {
+      if (use_df())
+        cpu.orbit_trap_df(field->cpu_buff, param->cpu_buff[0], df_view(),
+                          {bb, bt, bl, br}, real, N, M);
+      else
+        cpu.orbit_trap(field->cpu_buff, param->cpu_buff[0], {bb, bt, bl, br},
+                       real, N, M);
+      field->mark_host_dirty();
+      return;
+    }
+
+    if (use_df()) {
+      string kernel = real ? "orbit_trap_df_re" : "orbit_trap_df_im";
+      ecl.apply_kernel(spec_kernel(kernel), *field, *param, *early, df_view(),
+                       Box{bb, bt, bl, br});
+      return;
+    }
+    string kernel = real ? "orbit_trap_re" : "orbit_trap_im";
+    if (use_f32())
+      kernel = real ? "orbit_trap_f32_re" : "orbit_trap_f32_im";
+    ecl.apply_kernel(spec_kernel(kernel), *field, *param, *early,
+                     Box{bb, bt, bl, br});
+  }
+}
+
+void FractalCompute::deep_field(SynchronisedArray<FPN> *field, int field_type,
+                                int PROXTYPE, Box trap, bool real)
+// one pass over every pixel, then re-reference on a glitched pixel and redo
+// just those, until none are left or we run out of passes
+{
+  deep.reference(param->cpu_buff[0], viewport_deltas, N, M);
+
+  for (int pass = 0; pass <= deep.max_passes; pass++) {
+    if (ref_orbit->items < (int)deep.orbit.size()) {
+      delete ref_orbit;
+      ref_orbit = new SynchronisedArray<Complex>(
+          ecl.context, CL_MEM_READ_ONLY, {(int)deep.orbit.size()});
+    }
+    // only uploaded when the orbit or mapping changed
+    ref_orbit->update(deep.orbit.data(), deep.orbit.size());
+
+    DeepParam_t dp = deep.pixel_map(viewport_deltas, N, M);
+    dp.pass = pass;
+    deep_param->update(&dp);
+
+    deep_pass(field, field_type, PROXTYPE, trap, real);
+    ecl.read(*glitch, "glitch");
+
+    vector<int> glitched;
+    for (int k = 0; k < N * M; k++) {
+      if (glitch->cpu_buff[k])
+        glitched.push_back(k);
+    }
+    deep.glitched = glitched.size();
+    if (glitched.empty() || pass == deep.max_passes)
+      break;
+
+    int k = glitched[glitched.size() / 2];
+    int i = k / M, j = k % M;
+    deep.rereference(param->cpu_buff[0], {dp.offset.re + j * dp.step.re,
+                                   dp.offset.im + i * dp.step.im});
+  }
+}
+
+void FractalCompute::deep_pass(SynchronisedArray<FPN> *field, int field_type,
+                               int PROXTYPE, Box trap, bool real) {
+  if (backend == ComputeBackend::CPU) {
+    switch (field_type) {
+    case 0:
+      cpu.escape_iter_pert(field->cpu_buff, param->cpu_buff[0],
+                           deep_param->cpu_buff[0], ref_orbit->cpu_buff,
+                           glitch->cpu_buff, N, M);
+      break;
+    case 1:
+      cpu.min_prox_pert(field->cpu_buff, param->cpu_buff[0],
+                        deep_param->cpu_buff[0], ref_orbit->cpu_buff,
+                        glitch->cpu_buff, PROXTYPE, N, M);
+      break;
+    case 2:
+      cpu.orbit_trap_pert(field->cpu_buff, param->cpu_buff[0],
+                          deep_param->cpu_buff[0], ref_orbit->cpu_buff,
+                          glitch->cpu_buff, trap, real, N, M);
+      break;
+    }
+    field->mark_host_dirty();
+    glitch->mark_host_dirty();
+    return;
+  }
+
+  switch (field_type) {
+  case 0:
+    ecl.apply_kernel("escape_iter_pert", *field, *param, *deep_param,
+                     *ref_orbit, *glitch);
+    break;
+  case 1:
+    ecl.apply_kernel("min_prox_pert", *field, *param, *deep_param, *ref_orbit,
+                     *glitch, PROXTYPE);
+    break;
+  case 2: {
+    string kernel = real ? "orbit_trap_pert_re" : "orbit_trap_pert_im";
+    ecl.apply_kernel(kernel, *field, *param, *deep_param, *ref_orbit, *glitch,
+                     trap);
+    break;
+  }
+  }
+}
+
+void FractalCompute::field_stats(SynchronisedArray<FPN> *field, int ch) {
+  if (backend == ComputeBackend::CPU) {
+    ecl.read(*field);
+    cpu.field_stats(field->cpu_buff, tone_clip, stats->cpu_buff[ch],
+                    cdf->cpu_buff + ch * HIST_BINS, N, M);
+    return;
+  }
+
+  // a power of two up to REDUCE_SIZE (mandel.cl) that all kernels can run
+  size_t most = min({(size_t)256, ecl.max_group_size("field_minmax"),
+                     ecl.max_group_size("stats_range"),
+                     ecl.max_group_size("field_hist"),
+                     ecl.max_group_size("hist_cdf")});
+  size_t size = 1;
+  while (size * 2 <= most)
+    size *= 2;
+
+  int n = N * M;
+  ecl.apply_kernel_groups("field_minmax", reduce_groups, size, *field,
+                          *reduce_part, n);
+  ecl.apply_kernel_groups("stats_range", 1, size, *reduce_part, *stats,
+                          *hist, (int)reduce_groups, ch);
+  for (int refine = 1; refine >= 0; refine--) {
+    ecl.apply_kernel_groups("field_hist", reduce_groups, size, *field, *stats,
+                            *hist, n, ch);
+    ecl.apply_kernel_groups("hist_cdf", 1, size, *hist, *stats, *cdf,
+                            tone_clip, ch, refine);
+  }
+}
+
+FPN *FractalCompute::tone_host(SynchronisedArray<FPN> *field, int ch) {
+  ecl.read(*field);
+  if (tone == TONE_FIXED)
+    return field->cpu_buff;
+
+  field_stats(field, ch);
+  toned[ch].resize(N * M);
+  cpu.tone(field->cpu_buff, toned[ch].data(), stats->cpu_buff[ch],
+           cdf->cpu_buff + ch * HIST_BINS, tone, N, M);
+  return toned[ch].data();
+}
+
+void FractalCompute::map_sines(FPN f1, FPN f2, FPN f3) {
+  if (compute_enabled) {
+    if (backend == ComputeBackend::CPU) {
+      cpu.map_sines(tone_host(field1, 0), pix->cpu_buff, {f1, f2, f3}, N, M);
+      pix->mark_host_dirty();
+      return;
+    }
+
+    if (tone == TONE_FIXED) {
+      ecl.apply_kernel("map_sines", *field1, *pix, Freqs{f1, f2, f3});
+      return;
+    }
+    field_stats(field1, 0);
+    ecl.apply_kernel("map_sines_tone", *field1, *pix, Freqs{f1, f2, f3},
+                     *stats, *cdf, tone);
+  }
+}
+
+void FractalCompute::map_img(string img_file) {
+  if (compute_enabled) {
+    SynchronisedArray<Pixel> *img = images.get(img_file, wait_for_images);
+    if (!img)
+      return; // still decoding (or failed), keeping the last frame
+    ImDims dims = {img->dims.x, img->dims.y};
+
+    if (backend == ComputeBackend::CPU) {
+      cpu.map_img(tone_host(field1, 0), tone_host(field2, 1), img->cpu_buff,
+                  dims, pix->cpu_buff, N, M);
+      pix->mark_host_dirty();
+    } else if (tone == TONE_FIXED) {
+      ecl.apply_kernel("map_img2", *field1, *field2, *img, *pix, dims);
+    } else {
+      field_stats(field1, 0);
+      field_stats(field2, 1);
+      ecl.apply_kernel("map_img2_tone", *field1, *field2, *img, *pix, dims,
+                       *stats, *cdf, tone);
+    }
+  }
+}
+
+void FractalCompute::fields_to_RGB(bool norm = false) {
+  if (backend == ComputeBackend::CPU) {
+    cpu.pack(tone_host(field1, 0), tone_host(field2, 1), tone_host(field3, 2),
+             pix->cpu_buff, norm, N, M);
+    pix->mark_host_dirty();
+    return;
+  }
+
+  if (tone == TONE_FIXED) {
+    string kernel = norm ? "pack_norm" : "pack";
+    ecl.apply_kernel(kernel, *field1, *field2, *field3, *pix);
+    return;
+  }
+  for (int ch = 0; ch < 3; ch++)
+    field_stats(ch == 0 ? field1 : ch == 1 ? field2 : field3, ch);
+  ecl.apply_kernel("pack_tone", *field1, *field2, *field3, *pix, *stats, *cdf,
+                   tone, (int)norm);
+}
+
+void FractalCompute::compute_join() {
+  if (ecl.available) {
+    ecl.queue.finish();
+    while (!in_flight.empty()) {
+      retire_frame(in_flight.front());
+      in_flight.pop_front();
+    }
+    ecl.collect_profile();
+    ecl.read(*early, "early"); // only if a kernel counted since the last reset
+  }
+
+  early_exits = early->cpu_buff[0] + cpu.early_exits.exchange(0);
+  if (early->cpu_buff[0] != 0)
+    (*early)[0] = 0; // uploaded with the next kernel using it
+}
+
+void FractalCompute::free_stale(bool wait) {
+  for (size_t k = 0; k < stale.size();) {
+    cl::Event &read = stale[k].read;
+    if (wait)
+      read.wait();
+    if (wait || read.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>(nullptr) ==
+                    CL_COMPLETE) {
+      delete[] stale[k].pixels;
+      stale.erase(stale.begin() + k);
+    } else {
+      k++;
+    }
+  }
+}
+
+void CL_CALLBACK FractalCompute::read_done(cl_event, cl_int, void *done) {
+  auto *cell = (shared_ptr<FrameDone> *)done;
+  (*cell)->ns = chrono::steady_clock::now().time_since_epoch().count();
+  delete cell;
+}
+
+void FractalCompute::retire_frame(int k) {
+  shown = k;
+  early_exits = slots[k].done->early + cpu.early_exits.exchange(0);
+
+  auto now = chrono::steady_clock::now();
+  // the device works on a frame from when it is queued, or the previous one
+  // is done, until its read completes (noticed here later than that)
+  long long done_ns = slots[k].done->ns;
+  auto done = done_ns ? chrono::steady_clock::time_point(
+                            chrono::steady_clock::duration(done_ns))
+                      : now;
+  if (slots[k].full) {
+    chrono::duration<float, milli> busy =
+        done - max(slots[k].started, device_done);
+    compute_ms = compute_ms == 0 ? busy.count()
+                                 : 0.8 * compute_ms + 0.2 * busy.count();
+  }
+  device_done = done;
+
+  chrono::duration<float, milli> latency = now - slots[k].started;
+  chrono::duration<float> interval = now - last_done;
+  frame_latency_ms = 0.9 * frame_latency_ms + 0.1 * latency.count();
+  if (interval.count() > 0)
+    frame_rate = 0.9 * frame_rate + 0.1 / interval.count();
+  last_done = now;
+}
+
+void FractalCompute::collect_frames() {
+  frame_start = chrono::steady_clock::now();
+  free_stale(false);
+  while (!in_flight.empty() &&
+         slots[in_flight.front()]
+                 .read.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>(nullptr) ==
+             CL_COMPLETE) {
+    retire_frame(in_flight.front());
+    in_flight.pop_front();
+  }
+  if (ecl.available)
+    ecl.collect_profile();
+}
+
+void FractalCompute::submit_frame() {
+  if (!ecl.available || backend == ComputeBackend::CPU) {
+    shown = -1; // computed into pix on the host
+    early_exits = cpu.early_exits.exchange(0);
+    chrono::duration<float, milli> took =
+        chrono::steady_clock::now() - frame_start;
+    if (full_frame)
+      compute_ms = compute_ms == 0 ? took.count()
+                                   : 0.8 * compute_ms + 0.2 * took.count();
+    full_frame = false;
+    return;
+  }
+  if (ecl.launched == submitted) // nothing new this frame
+    return;
+  submitted = ecl.launched;
+
+  int k = 0;
+  while (k == shown || find(in_flight.begin(), in_flight.end(), k) !=
+                           in_flight.end())
+    k++;
+  FrameSlot &slot = slots[k];
+  slot.started = frame_start;
+  slot.full = full_frame;
+  full_frame = false;
+  slot.done = make_shared<FrameDone>();
+  // in order, so the pixels arriving means the counter has too
+  ecl.read_async(*early, &slot.done->early, slot.read, "early");
+  ecl.read_async(*pix, slot.pixels, slot.read, "pix");
+  auto *cell = new shared_ptr<FrameDone>(slot.done);
+  if (slot.read.setCallback(CL_COMPLETE, read_done, cell) != CL_SUCCESS)
+    delete cell; // retire_frame then takes the time it notices the read
+  (*early)[0] = 0; // uploaded with the next kernel using it
+  in_flight.push_back(k);
+  ecl.queue.flush();
+
+  // per frame profiles need each frame to be done before the next starts
+  int depth = ecl.profiling ? 1 : frames_in_flight;
+  while ((int)in_flight.size() >= depth) {
+    slots[in_flight.front()].read.wait();
+    retire_frame(in_flight.front());
+    in_flight.pop_front();
+  }
+}
+
+bool FractalCompute::has_frame() {
+  return shown >= 0 || !ecl.available || backend == ComputeBackend::CPU;
+}
+
+Pixel *FractalCompute::frame_pixels() {
+  if (shown < 0 || backend == ComputeBackend::CPU)
+    return pix->cpu_buff;
+  return slots[shown].pixels;
+}
+
+void FractalCompute::reset_view() {
+  if (mandel) {
+    viewport_center = {-0.75, 0};
+    viewport_deltas = {1.25, 1.25};
+  } else {
+    viewport_center = {0, 0};
+    viewport_deltas = {2, 2};
+  }
+  deep.set_center(viewport_center.re, viewport_center.im);
+}
@@ -0,0 +1,311 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../mandelstructs.h"
+#include "cpu_backend.hpp"
+#include "deep_zoom.hpp"
+#include "easy_cl.hpp"
+#include "image_cache.hpp"
+#include "multi_device.hpp"
+
+using namespace std;
+
+enum ComputeMode { SingleField = 0, DualField = 1, TriField = 2 };
+
+enum ComputeBackend { OpenCL = 0, CPU = 1 };
+
+// of the field computations, the double-float and (double build) float
+// kernels only iterate the default z^2 + c, like deep zoom. Auto picks per
+// frame from the pixel spacing
+enum Precision { Native = 0, DoubleFloat = 1, Single = 2, Auto = 3 };
+const char *precision_name(int precision); // of the arithmetic, e.g. "float"
+
+struct FieldUIState {
+  int field = 0;
+  int proxtype = 1;
+  bool real = false;
+  // unfortunately cannot just use Box struct, since imgui sliders work on float
+  float box_bot = 0;
+  float box_top = 0.5;
+  float box_left = 0;
+  float box_right = 0.5;
+};
+
+class FractalCompute
+// Compute state and jobs, without any windowing or UI, so that it can be
+// shared between the GUI (App) and the headless renderer.
+{
+public:
+  int N;
+  int M;
+
+  EasyCL ecl;
+  CpuBackend cpu;
+  ImageCache images; // for map_img
+  bool wait_for_images = false; // else map_img skips frames while decoding
+
+  SynchronisedArray<FPN> *field1;
+  SynchronisedArray<FPN> *field2;
+  SynchronisedArray<FPN> *field3;
+
+  SynchronisedArray<FParam> *param;
+  SynchronisedArray<Pixel> *pix;
+
+  // what each field currently holds, so that unchanged fields are not
+  // recomputed, and pans by whole pixels only compute the exposed strips
+  struct FieldContents {
+    bool valid = false;
+    int backend;
+    FParam_t param;
+    FieldUIState state;
+    int step = 1; // of the last progressive pass, 1 once complete
+    int precision = Precision::Native;
+    DFParam_t view = {}; // if DoubleFloat, pans are only seen here
+  };
+  map<SynchronisedArray<FPN> *, FieldContents> computed;
+  bool reuse_fields = true;
+  // coarse to fine passes (OpenCL only), one per compute_field call, any
+  // change restarts them
+  bool progressive = false;
+  int coarsest_step = 8;
+  SynchronisedArray<FParam> *pass_param;
+  SynchronisedArray<FPN> *scratch; // for shifting fields
+  // Mariani-Silver subdivision of iters fields (OpenCL only), tiles with a
+  // uniform border are filled instead of computed
+  bool subdivide = false;
+  int ms_tile = 32; // largest tile size, halved down to ms_min
+  int ms_min = 4;
+  SynchronisedArray<int> *ms_active[2]; // tile flags of this and next level
+
+  // INTERIOR_* bits, stopping early on points in the set without changing
+  // the result. The bulb test is dropped for Julia sets and edited functions
+  int interior = INTERIOR_BULBS | INTERIOR_PERIOD;
+  bool default_func = true; // compiled into the kernels
+  SynchronisedArray<int> *early; // device side counter of early exits
+  int early_exits = 0;           // of the jobs up to the last compute_join
+
+  // compute the fields of the Dual/Tri modes with one kernel, generated for
+  // the combination of field types, iterating each orbit once for all of them
+  bool fuse_fields = true;
+
+  // full field computations split over every OpenCL device, mapping stays
+  // on the primary one. The device list is made on first use
+  bool multi_device = false;
+  int cpu_split = 0; // compute units per CPU sub-device, 0 for whole devices
+  MultiDevice *multi = nullptr;
+
+  // FPN (Native), double-float field kernels, which reach ~1e-11 view widths
+  // with float arithmetic only, mapped from the DeepZoom center, or float ones
+  int precision = Precision::Native;
+  int precision_used = Precision::Native; // by the last computed field
+  // what precision resolves to for this frame, the cheapest one whose rounding
+  // stays well under the pixel spacing if Auto
+  int frame_precision();
+  bool use_df() { return frame_precision() == Precision::DoubleFloat; }
+  bool use_f32() { return frame_precision() == Precision::Single; }
+  DFParam_t df_view();
+
+  // field kernels rebuilt with mandel/Julia, a bound on MAXITER (the power of
+  // two at or above it), the PROXTYPE of proximity fields and the exponent of
+  // f baked in (-D SPEC_*). Variants build in the background, the generic
+  // kernels running meanwhile, and the max_variants most recently used are kept
+  bool specialize = true;
+  int max_variants = 8;
+  bool wait_for_variants = false; // block on their builds instead
+  double variant_wait_ms = 0;     // spent blocking on them, in total
+  string variant_used = "";       // by the last full field, "" for generic
+  // name of the kernel built for the current settings, name itself while that
+  // variant builds (or if it failed)
+  string spec_kernel(string name, int PROXTYPE = -1);
+
+  // benchmarks local work-group shapes for the field kernels, which are used
+  // from then on and saved per device (see EasyCL::autotune)
+  void autotune(int reps = 5);
+
+  // perturbation mode
+  DeepZoom deep;
+  bool deep_zoom = false;
+  SynchronisedArray<DeepParam> *deep_param;
+  SynchronisedArray<Complex> *ref_orbit;
+  SynchronisedArray<int> *glitch;
+
+  Complex viewport_center = {-0.75, 0};
+  Complex viewport_deltas = {1.25, 1.25};
+  int MAXITER = 100;
+  int backend = ComputeBackend::OpenCL;
+  float cre = -0.85, cim = 0.6;
+  bool mandel = true;
+
+  bool compute_enabled = false;
+
+  string default_recurse_func = "inline Complex_t f(Complex_t z, Complex_t c)\n\
+{\n\
+    return complex_add(complex_pow(z, 2), c);\n\
+}";
+
+  FractalCompute(int N, int M, bool verbose = false);
+  ~FractalCompute();
+
+  // reallocates the per pixel buffers, if the size changed. Frames in flight
+  // are dropped without waiting for them
+  void resize(int N, int M);
+  // copies the view and general params into param
+  void update_params();
+
+  // gpu jobs
+  void min_prox(SynchronisedArray<FPN> *prox, int PROXTYPE);
+  void escape_iter(SynchronisedArray<FPN> *prox);
+  void mariani_silver(SynchronisedArray<FPN> *field);
+  void orbit_trap(SynchronisedArray<FPN> *prox, float bb, float bt, float bl,
+                  float br, bool real);
+  void compute_field(SynchronisedArray<FPN> *field, FieldUIState *state);
+  // several fields, fused if possible, in which case the output step (pack,
+  // pack_norm or map_img2 with img_file) is fused in too and true returned,
+  // else it is left to fields_to_RGB/map_img
+  bool compute_fields(vector<SynchronisedArray<FPN> *> fields,
+                      vector<FieldUIState *> states, string output = "",
+                      string img_file = "");
+  // name of the fused kernel for 2-3 fields, built on first use, "" if the
+  // build failed (see fused_source for its arguments)
+  string fused_kernel(vector<FieldUIState *> states, string output = "");
+  void deep_field(SynchronisedArray<FPN> *field, int field_type, int PROXTYPE,
+                  Box trap, bool real);
+  void deep_pass(SynchronisedArray<FPN> *field, int field_type, int PROXTYPE,
+                 Box trap, bool real);
+  // what the colormaps are given of each field (TONE_*). The other modes use
+  // statistics reduced on the device, without reading the fields back: the
+  // tone_clip and 1 - tone_clip percentiles (TONE_RANGE) or the cumulative
+  // histogram (TONE_EQUALIZE). They turn off the fused output step
+  int tone = TONE_FIXED;
+  float tone_clip = 0.01;
+  SynchronisedArray<FieldStats> *stats; // per colormap input, of the last map
+  SynchronisedArray<float> *cdf;        // HIST_BINS per colormap input
+  // reduces field into the ch-th entries of stats and cdf
+  void field_stats(SynchronisedArray<FPN> *field, int ch);
+
+  void map_sines(FPN f1, FPN f2, FPN f3);
+  void map_img(string img_file);
+  void fields_to_RGB(bool normalise);
+
+  void compute_join();
+  // brings pix back to the host for display, everything else stays on the
+  // device unless read explicitly (see EasyCL::read)
+  void read_frame();
+
+  // pipelined frames, for the GUI instead of compute_join/read_frame.
+  // collect_frames at the start of a frame takes the completed ones without
+  // waiting, submit_frame after queueing the jobs reads pix back into a ring
+  // slot, only waiting if frames_in_flight are queued, and frame_pixels is
+  // the latest completed one
+  int frames_in_flight = 2; // 1 waits for every frame
+  const static int max_frames_in_flight = 3;
+  float frame_latency_ms = 0; // from queueing to seen completed, smoothed
+  float frame_rate = 0;       // completed frames per second, smoothed
+  // device time of the recent frames that computed whole fields (not just
+  // reused, shifted or progressive ones), smoothed
+  float compute_ms = 0;
+  void collect_frames();
+  void submit_frame();
+  Pixel *frame_pixels();
+  // false until a frame of the current size has completed
+  bool has_frame();
+  bool compile_kernels(string new_func);
+  // builds on a background thread, the current kernels rendering until a
+  // poll_compile swaps the new ones in. Requests made while building are
+  // queued, keeping only the latest
+  void compile_kernels_async(string new_func);
+  // call once per frame, outside of any queued jobs, true when a build has
+  // been installed or rejected (see build_ok and ecl.cl_error)
+  bool poll_compile();
+  bool compiling() { return build.valid(); }
+  bool build_ok = true; // of the last build, a failed one keeps the old kernels
+  string installed_func = ""; // of the kernels in use, "" for the default
+  void reset_view();
+
+private:
+  bool pan_offset(FieldContents &prev, FieldContents &now, int &di, int &dj);
+  void shift_field(SynchronisedArray<FPN> *field, FieldUIState *state, int di,
+                   int dj);
+  void field_region(SynchronisedArray<FPN> *field, FieldUIState *state, Tile r,
+                    SynchronisedArray<FParam> &p);
+  void multi_field(SynchronisedArray<FPN> *field, FieldUIState *state);
+  void progressive_pass(SynchronisedArray<FPN> *field, FieldUIState *state,
+                        int step, int skip);
+
+  // program text and options of the last successful compile_kernels, which
+  // the fused kernels are built on
+  string kernel_source;
+  string build_options;
+  map<string, bool> fused_built; // kernel name -> build succeeded
+
+  struct KernelBuild {
+    EasyCL::Build build;
+    string func;
+    string source;
+    string options;
+  };
+  // only reads the sources and builds, safe to run in the background
+  KernelBuild build_kernels(string new_func);
+  bool install_kernels(KernelBuild &b);
+  future<KernelBuild> build;
+  bool build_queued = false;
+  string queued_func;
+
+  int spec_power = 0;      // of every complex_pow in f, see common_power
+  list<string> variants;   // keys, least recently used first
+  map<string, bool> variant_ok;
+  future<EasyCL::Build> variant_build;
+  string variant_key;      // of variant_build
+  int program_gen = 0;     // installs so far, older variants are dropped
+  int variant_gen = 0;     // of variant_build
+  void poll_variant(bool wait);
+  void drop_variants();
+
+  // written by the reads of one submission, which may complete after its
+  // slot is reused or dropped, so kept alive by the read's callback
+  struct FrameDone {
+    int early = 0;
+    atomic<long long> ns{0}; // steady_clock, set by the read's callback
+  };
+  struct FrameSlot {
+    Pixel *pixels = nullptr;
+    cl::Event read;
+    chrono::steady_clock::time_point started;
+    bool full = false; // computed whole fields
+    shared_ptr<FrameDone> done;
+  };
+  // user data a new shared_ptr<FrameDone>, deleted once set
+  static void CL_CALLBACK read_done(cl_event, cl_int, void *done);
+  // one more than can be in flight, for the one on display
+  FrameSlot slots[max_frames_in_flight + 1];
+  deque<int> in_flight; // oldest first
+  int shown = -1;       // slot of frame_pixels, -1 for pix
+  unsigned long submitted = 0; // ecl.launched at the last submit_frame
+  chrono::steady_clock::time_point frame_start;
+  chrono::steady_clock::time_point last_done;
+  chrono::steady_clock::time_point device_done; // of the last retired frame
+  bool full_frame = false; // whole fields queued since the last submit_frame
+  void retire_frame(int k);
+  // slot buffers of the frames dropped by resize, freed once read
+  vector<FrameSlot> stale;
+  void free_stale(bool wait);
+
+  SynchronisedArray<FPN> *reduce_part; // min and max per work-group
+  SynchronisedArray<int> *hist;
+  const static int reduce_groups = 64;
+  vector<FPN> toned[3]; // CPU backend
+  // the field as given to the colormaps (on the host, for the CPU backend)
+  FPN *tone_host(SynchronisedArray<FPN> *field, int ch);
+
+  void alloc_buffers();
+  void free_buffers();
+};
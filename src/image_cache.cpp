@@ -0,0 +1,287 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "image_cache.hpp"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+namespace fs = std::filesystem;
+
+// header of the raw files, followed by the pixels in SynchronisedArray order
+struct RawHeader {
+  char magic[8];
+  long long mtime; // of the source image
+  int w, h;
+};
+
+static const char raw_magic[8] = {'C', 'L', 'I', 'M', 'R', 'A', 'W', '1'};
+
+ImageCache::ImageCache(cl::Context &context) : context(context) {
+  worker_thread = std::thread(&ImageCache::worker, this);
+}
+
+ImageCache::~ImageCache() {
+  {
+    std::lock_guard<std::mutex> lk(lock);
+    stopping = true;
+  }
+  job_cv.notify_all();
+  worker_thread.join();
+
+  for (auto &[path, e] : entries)
+    delete e.img;
+  for (auto &[path, d] : done)
+    delete d.img;
+}
+
+SynchronisedArray<Pixel> *ImageCache::get(std::string path, bool wait) {
+  if (!request(path))
+    return nullptr;
+
+  Entry &e = entries[path];
+  if (e.loading) {
+    if (wait) {
+      std::unique_lock<std::mutex> lk(lock);
+      done_cv.wait(lk, [&] {
+        return done.count(path) && done[path].mtime == e.mtime;
+      });
+    }
+    collect(path, e);
+  }
+  if (!e.img)
+    return nullptr;
+
+  e.last_used = ++tick;
+  evict(path);
+  return e.img;
+}
+
+void ImageCache::prefetch(std::string path) { request(path); }
+
+bool ImageCache::pending(std::string path) {
+  auto it = entries.find(path);
+  if (it == entries.end())
+    return false;
+  if (it->second.loading)
+    collect(path, it->second);
+  return it->second.loading;
+}
+
+bool ImageCache::request(std::string path)
+// queues a decode, unless the current version is loaded, loading or failed
+{
+  std::error_code ec;
+  Time mtime = fs::last_write_time(path, ec);
+  if (ec) {
+    auto it = entries.find(path);
+    if (it != entries.end()) {
+      if (it->second.img) {
+        resident -= it->second.img->buffsize;
+        delete it->second.img;
+      }
+      entries.erase(it);
+    }
+    return false;
+  }
+
+  auto it = entries.find(path);
+  if (it != entries.end() && it->second.mtime == mtime)
+    return true;
+
+  Entry &e = entries[path];
+  if (e.img) { // file changed
+    resident -= e.img->buffsize;
+    delete e.img;
+  }
+  e = Entry();
+  e.mtime = mtime;
+  e.loading = true;
+
+  {
+    std::lock_guard<std::mutex> lk(lock);
+    jobs.push_back({path, mtime, raw_dir});
+  }
+  job_cv.notify_one();
+  return true;
+}
+
+void ImageCache::collect(std::string path, Entry &e)
+// takes the decoded image from the worker, if done
+{
+  Decoded d;
+  {
+    std::lock_guard<std::mutex> lk(lock);
+    auto it = done.find(path);
+    if (it == done.end())
+      return;
+    d = it->second;
+    done.erase(it);
+  }
+
+  if (d.mtime != e.mtime) { // of an older version of the file
+    delete d.img;
+    return;
+  }
+  e.loading = false;
+  e.failed = d.img == nullptr;
+  e.img = d.img;
+  if (e.img)
+    resident += e.img->buffsize;
+}
+
+void ImageCache::evict(std::string keep) {
+  while (resident > budget) {
+    auto lru = entries.end();
+    for (auto it = entries.begin(); it != entries.end(); it++) {
+      if (it->second.img && it->first != keep &&
+          (lru == entries.end() ||
+           it->second.last_used < lru->second.last_used))
+        lru = it;
+    }
+    if (lru == entries.end())
+      return;
+
+    resident -= lru->second.img->buffsize;
+    delete lru->second.img; // the device copy lives on until queued kernels
+                            // using it are done
+    entries.erase(lru);
+  }
+}
+
+void ImageCache::worker() {
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lk(lock);
+      job_cv.wait(lk, [this] { return stopping || !jobs.empty(); });
+      if (stopping)
+        return;
+      job = jobs.front();
+      jobs.pop_front();
+    }
+
+    SynchronisedArray<Pixel> *img = nullptr;
+    if (job.raw_dir != "")
+      img = read_raw(job);
+    if (!img) {
+      img = decode(job.path);
+      if (img && job.raw_dir != "")
+        write_raw(job, img);
+    }
+
+    {
+      std::lock_guard<std::mutex> lk(lock);
+      auto it = done.find(job.path);
+      if (it != done.end()) // never collected
+        delete it->second.img;
+      done[job.path] = {job.mtime, img};
+    }
+    done_cv.notify_all();
+  }
+}
+
+SynchronisedArray<Pixel> *ImageCache::decode(std::string path) {
+  int w;
+  int h;
+  int comp;
+  unsigned char *image = stbi_load(path.c_str(), &w, &h, &comp, STBI_rgb);
+  if (!image) {
+    std::cerr << "Failed to load " << path << ": " << stbi_failure_reason()
+              << "\n";
+    return nullptr;
+  }
+
+  // indexed [x, y], as map_img2 expects
+  SynchronisedArray<Pixel> *img =
+      new SynchronisedArray<Pixel>(context, CL_MEM_READ_ONLY, {w, h});
+  for (int i = 0; i < w; i++) {
+    for (int j = 0; j < h; j++) {
+      int k = j * w + i;
+      img->cpu_buff[i * h + j] = {image[3 * k], image[3 * k + 1],
+                                  image[3 * k + 2]};
+    }
+  }
+
+  stbi_image_free(image);
+  return img;
+}
+
+std::string ImageCache::raw_path(const Job &job) {
+  std::stringstream name;
+  name << std::hex
+       << std::hash<std::string>{}(fs::absolute(job.path).string()) << ".raw";
+  return (fs::path(job.raw_dir) / name.str()).string();
+}
+
+SynchronisedArray<Pixel> *ImageCache::read_raw(const Job &job)
+// nullptr if there is no raw file for this version of the image
+{
+  std::string file = raw_path(job);
+  RawHeader header;
+  SynchronisedArray<Pixel> *img = nullptr;
+
+#ifdef _WIN32
+  std::ifstream f(file, std::ios_base::binary);
+  if (!f.read((char *)&header, sizeof(header)) ||
+      memcmp(header.magic, raw_magic, 8) != 0 ||
+      header.mtime != job.mtime.time_since_epoch().count())
+    return nullptr;
+  img = new SynchronisedArray<Pixel>(context, CL_MEM_READ_ONLY,
+                                     {header.w, header.h});
+  if (!f.read((char *)img->cpu_buff, img->buffsize)) {
+    delete img;
+    return nullptr;
+  }
+#else
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(header)) {
+    close(fd);
+    return nullptr;
+  }
+  void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return nullptr;
+
+  memcpy(&header, map, sizeof(header));
+  size_t size = (size_t)header.w * header.h * sizeof(Pixel);
+  if (memcmp(header.magic, raw_magic, 8) == 0 &&
+      header.mtime == job.mtime.time_since_epoch().count() &&
+      (size_t)st.st_size == sizeof(header) + size) {
+    img = new SynchronisedArray<Pixel>(context, CL_MEM_READ_ONLY,
+                                       {header.w, header.h});
+    memcpy(img->cpu_buff, (char *)map + sizeof(header), size);
+  }
+  munmap(map, st.st_size);
+#endif
+
+  return img;
+}
+
+void ImageCache::write_raw(const Job &job, SynchronisedArray<Pixel> *img) {
+  std::error_code ec;
+  fs::create_directories(job.raw_dir, ec);
+
+  RawHeader header;
+  memcpy(header.magic, raw_magic, 8);
+  header.mtime = job.mtime.time_since_epoch().count();
+  header.w = img->dims.x;
+  header.h = img->dims.y;
+
+  std::ofstream f(raw_path(job), std::ios_base::binary);
+  f.write((char *)&header, sizeof(header));
+  f.write((char *)img->cpu_buff, img->buffsize);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "../mandelstructs.h"
+#include "easy_cl.hpp"
+
+class ImageCache
+// Sample images for map_img, decoded on a background thread into arrays that
+// stay resident (host copy, and device copy once a kernel has used them) so
+// that switching between images costs nothing after the first use. Entries
+// are keyed by path, reloaded when the file's mtime changes, and the least
+// recently used ones are evicted to stay within the budget.
+{
+public:
+  size_t budget = 256 << 20; // bytes
+  // if set, decoded images are also written here in a raw format, which later
+  // runs memory map instead of decoding. Taken by the decodes queued after it
+  // changes, the worker only using their copies
+  std::string raw_dir = "";
+
+  ImageCache(cl::Context &context);
+  ~ImageCache();
+
+  // nullptr while still decoding (unless waiting for it) or if it failed to
+  // load. Owned by the cache, valid until a get for another path evicts it
+  SynchronisedArray<Pixel> *get(std::string path, bool wait = false);
+  void prefetch(std::string path);
+  bool pending(std::string path);
+  size_t bytes() { return resident; }
+
+private:
+  typedef std::filesystem::file_time_type Time;
+
+  struct Entry {
+    Time mtime;
+    SynchronisedArray<Pixel> *img = nullptr;
+    bool loading = false;
+    bool failed = false;
+    unsigned long last_used = 0;
+  };
+
+  struct Job {
+    std::string path;
+    Time mtime;
+    std::string raw_dir; // as when queued
+  };
+
+  // a finished decode, handed from the worker to the next get
+  struct Decoded {
+    Time mtime;
+    SynchronisedArray<Pixel> *img; // nullptr if it failed
+  };
+
+  cl::Context &context;
+  std::map<std::string, Entry> entries;
+  unsigned long tick = 0;
+  size_t resident = 0;
+
+  std::mutex lock; // guards jobs, done and stopping
+  std::condition_variable job_cv;
+  std::condition_variable done_cv;
+  std::deque<Job> jobs;
+  std::map<std::string, Decoded> done;
+  bool stopping = false;
+  std::thread worker_thread;
+
+  bool request(std::string path); // false if the file is missing
+  void collect(std::string path, Entry &e);
+  void evict(std::string keep);
+  void worker();
+
+  SynchronisedArray<Pixel> *decode(std::string path);
+  std::string raw_path(const Job &job);
+  SynchronisedArray<Pixel> *read_raw(const Job &job);
+  void write_raw(const Job &job, SynchronisedArray<Pixel> *img);
+};
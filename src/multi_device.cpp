@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <thread>
+
+#include "multi_device.hpp"
+
+// entry points of the field kernels, the only ones run on the other devices
+static const std::vector<std::string> field_kernels{
+    "escape_iter_fpn", "min_prox",    "orbit_trap_re",    "orbit_trap_im",
+    "escape_iter_df",  "min_prox_df", "orbit_trap_df_re", "orbit_trap_df_im",
+    "escape_iter_f32", "min_prox_f32", "orbit_trap_f32_re", "orbit_trap_f32_im"};
+
+MultiDevice::MultiDevice(EasyCL &primary, int cpu_split)
+    : cpu_split(cpu_split) {
+  workers.push_back({&primary, false, true});
+  for (auto &device : EasyCL::all_devices(cpu_split)) {
+    // the primary, or a part of it if it is a CPU that cpu_split divides
+    if (device() == primary.device() ||
+        device.getInfo<CL_DEVICE_PARENT_DEVICE>() == primary.device())
+      continue;
+    workers.push_back({new EasyCL(device), true});
+    workers.back().ecl->tuning_file = primary.tuning_file;
+    workers.back().ecl->load_tuning();
+  }
+
+  for (auto &w : workers) {
+    w.name = w.ecl->device.getInfo<CL_DEVICE_NAME>();
+    w.param = new SynchronisedArray<FParam>(w.ecl->context, CL_MEM_READ_ONLY,
+                                            {1});
+    w.early = new SynchronisedArray<int>(w.ecl->context, {1});
+    (*w.early)[0] = 0;
+  }
+}
+
+MultiDevice::~MultiDevice() {
+  for (auto &w : workers) {
+    delete w.field;
+    delete w.param;
+    delete w.early;
+    if (w.own)
+      delete w.ecl;
+  }
+}
+
+void MultiDevice::set_program(std::string source, std::string options) {
+  this->source = source;
+  this->options = options;
+  for (auto &w : workers) {
+    if (w.own)
+      w.built = w.failed = false;
+  }
+}
+
+int MultiDevice::compute(FPN *dst, FParam_t p, int N, int M, Launch launch) {
+  next_row = 0;
+  std::vector<std::thread> threads;
+  for (auto &w : workers)
+    threads.emplace_back(&MultiDevice::run, this, std::ref(w), dst,
+                         std::ref(p), N, M, std::ref(launch));
+  for (auto &t : threads)
+    t.join();
+
+  int early_exits = 0;
+  for (auto &w : workers) {
+    if (w.failed)
+      continue;
+    w.ecl->read(*w.early, "early");
+    early_exits += w.early->cpu_buff[0];
+    if (w.early->cpu_buff[0] != 0)
+      (*w.early)[0] = 0;
+  }
+  return early_exits;
+}
+
+void MultiDevice::run(Worker &w, FPN *dst, FParam_t &p, int N, int M,
+                      Launch &launch)
+// one thread per device, each only using its own EasyCL
+{
+  w.rows = 0;
+  if (!w.built) { // e.g. no doubles on this device
+    bool ok = w.ecl->load_source(source, field_kernels, options);
+    std::lock_guard<std::mutex> lk(lock);
+    w.failed = !ok;
+    w.built = true;
+  }
+  if (w.failed)
+    return;
+
+  if (!w.field || w.field->dims.x != N || w.field->dims.y != M) {
+    delete w.field;
+    w.field = new SynchronisedArray<FPN>(w.ecl->context, {N, M});
+  }
+  w.param->update(&p);
+  w.ecl->queue.finish(); // not timing the primary's earlier work
+
+  // bands are read back without blocking, with the next one already queued
+  // behind the band waited on so that the device does not idle in between.
+  // Rates are taken from one band's completion to the next
+  std::deque<std::pair<Tile, cl::Event>> queued;
+  auto start = std::chrono::steady_clock::now();
+  bool more = true;
+  Tile t;
+  while (true) {
+    if (more && queued.size() < 2 && (more = next_tile(w, N, M, t))) {
+      launch(*w.ecl, *w.field, *w.param, *w.early, t);
+      size_t row = M * sizeof(FPN);
+      queued.push_back({t, cl::Event()});
+      w.ecl->read_range_async(*w.field, t.i0 * row, (t.i1 - t.i0) * row,
+                              dst + t.i0 * M, queued.back().second, "tile");
+      w.ecl->queue.flush();
+      continue;
+    }
+    if (queued.empty())
+      break;
+
+    t = queued.front().first;
+    queued.front().second.wait();
+    queued.pop_front();
+    auto done = std::chrono::steady_clock::now();
+    std::chrono::duration<float, std::milli> took = done - start;
+    start = done;
+
+    float rate = (t.i1 - t.i0) * M / std::max(took.count(), 1e-3f);
+    std::lock_guard<std::mutex> lk(lock);
+    w.rate = w.rate == 0 ? rate : 0.8 * w.rate + 0.2 * rate;
+    w.rows += t.i1 - t.i0;
+  }
+}
+
+bool MultiDevice::next_tile(Worker &w, int N, int M, Tile &t)
+// guided: a share of the remaining rows proportional to the device's rate,
+// halved so that every device gets a last, smaller band
+{
+  std::lock_guard<std::mutex> lk(lock);
+  if (next_row >= N)
+    return false;
+
+  float total = 0;
+  int active = 0;
+  bool measured = true; // else equal shares, until every device has a rate
+  for (auto &other : workers) {
+    if (other.failed)
+      continue;
+    total += other.rate;
+    active++;
+    measured = measured && other.rate > 0;
+  }
+  float share = measured ? w.rate / total : 1.0f / active;
+  int rows = std::max(min_rows, (int)((N - next_row) * share / 2));
+
+  t = {next_row, 0, std::min(N, next_row + rows), M};
+  next_row = t.i1;
+  return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../mandelstructs.h"
+#include "cpu_backend.hpp"
+#include "easy_cl.hpp"
+
+class MultiDevice
+// Splits field computations over every OpenCL device, the primary one (of
+// FractalCompute) included. Rows are handed out in bands as devices become
+// free, sized by each device's measured throughput so that the last bands
+// finish together, and read back into a host field.
+{
+public:
+  // enqueues the field kernel for tile r of field on ecl
+  typedef std::function<void(EasyCL &ecl, SynchronisedArray<FPN> &field,
+                             SynchronisedArray<FParam> &p,
+                             SynchronisedArray<int> &early, Tile r)>
+      Launch;
+
+  struct Worker {
+    EasyCL *ecl;
+    bool own;           // else the primary
+    bool built = false; // for the current source
+    bool failed = false;
+    SynchronisedArray<FPN> *field = nullptr;
+    SynchronisedArray<FParam> *param;
+    SynchronisedArray<int> *early;
+    std::string name;
+    float rate = 0; // pixels per ms, smoothed
+    int rows = 0;   // of the last field
+  };
+
+  std::vector<Worker> workers; // primary first
+  int cpu_split;
+  int min_rows = 8;
+
+  MultiDevice(EasyCL &primary, int cpu_split = 0);
+  ~MultiDevice();
+
+  // source and options of the primary's program, rebuilt on the others
+  // before their next use
+  void set_program(std::string source, std::string options);
+  // fills the N x M host field dst, returns the early exits
+  int compute(FPN *dst, FParam_t p, int N, int M, Launch launch);
+
+private:
+  std::string source;
+  std::string options;
+
+  std::mutex lock; // guards next_row and the rates
+  int next_row;
+
+  void run(Worker &w, FPN *dst, FParam_t &p, int N, int M, Launch &launch);
+  bool next_tile(Worker &w, int N, int M, Tile &t);
+};
@@ -0,0 +1,243 @@
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+
+#include "session.hpp"
+
+// header of the logs, followed by records of a type byte and its payload
+struct SessionHeader {
+  char magic[8];
+  int version;    // session_version
+  int frame_size; // sizeof(SessionFrame), differs with FPN
+  int fpn_size;
+};
+
+static const char session_magic[8] = {'C', 'L', 'I', 'M', 'S', 'E', 'S', '1'};
+
+enum SessionRecord : char {
+  FrameRecord = 'F',  // SessionFrame
+  RepeatRecord = 'R', // same frame as the last one, no payload
+  FuncRecord = 'f',   // strings, uint32 length then the bytes, for the
+  ImageRecord = 'i',  // frames from then on
+  CenterRecord = 'c',
+};
+
+SessionFrame session_frame(FractalCompute &fc, int compute_mode) {
+  SessionFrame f;
+  memset((void *)&f, 0, sizeof(f)); // padding too, frames are compared bytewise
+  f.param = fc.param->cpu_buff[0];
+  f.center = fc.viewport_center;
+  f.deltas = fc.viewport_deltas;
+  f.backend = fc.backend;
+  f.precision = fc.precision;
+  f.deep_zoom = fc.deep_zoom;
+  f.reuse_fields = fc.reuse_fields;
+  f.progressive = fc.progressive;
+  f.subdivide = fc.subdivide;
+  f.fuse_fields = fc.fuse_fields;
+  f.specialize = fc.specialize;
+  f.multi_device = fc.multi_device;
+  f.cpu_split = fc.cpu_split;
+  f.compute_mode = compute_mode;
+  f.tone = fc.tone;
+  f.tone_clip = fc.tone_clip;
+  return f;
+}
+
+string center_record(DeepZoom &deep)
+// "prec re im", exact, as mpf mantissa digits and exponent
+{
+  auto str = [](mpf_class &x) {
+    mp_exp_t exp;
+    string digits = x.get_str(exp, 10);
+    if (digits == "")
+      return string("0");
+    bool neg = digits[0] == '-';
+    return (neg ? "-0." : "0.") + digits.substr(neg) + "e" + to_string(exp);
+  };
+  mp_bitcnt_t prec = max(deep.center_re.get_prec(), deep.center_im.get_prec());
+  return to_string(prec) + " " + str(deep.center_re) + " " +
+         str(deep.center_im);
+}
+
+void apply_frame(FractalCompute &fc, const SessionFrame &f, string func,
+                 string center) {
+  fc.resize(f.param.dims.imH, f.param.dims.imW);
+  fc.backend = fc.ecl.available ? f.backend : ComputeBackend::CPU;
+  if (fc.ecl.available && func != fc.installed_func &&
+      !fc.compile_kernels(func))
+    throw runtime_error("Kernel build failed:\n" + fc.ecl.cl_error);
+
+  fc.viewport_center = f.center;
+  fc.viewport_deltas = f.deltas;
+  if (center != "") {
+    stringstream ss(center);
+    mp_bitcnt_t prec;
+    string re, im;
+    ss >> prec >> re >> im;
+    fc.deep.center_re = mpf_class(re, prec);
+    fc.deep.center_im = mpf_class(im, prec);
+  }
+
+  fc.MAXITER = f.param.MAXITER;
+  fc.mandel = f.param.mandel;
+  fc.cre = f.param.c.re;
+  fc.cim = f.param.c.im;
+  fc.interior = f.param.interior;
+  fc.precision = f.precision;
+  fc.deep_zoom = f.deep_zoom;
+  fc.reuse_fields = f.reuse_fields;
+  fc.progressive = f.progressive;
+  fc.subdivide = f.subdivide;
+  fc.fuse_fields = f.fuse_fields;
+  fc.specialize = f.specialize;
+  fc.multi_device = f.multi_device;
+  fc.cpu_split = f.cpu_split;
+  fc.tone = f.tone;
+  fc.tone_clip = f.tone_clip;
+  fc.update_params();
+  fc.param->update(&f.param); // exactly as recorded
+}
+
+void queue_frame(FractalCompute &fc, const SessionFrame &f, string image) {
+  FieldUIState s[3] = {f.fields[0], f.fields[1], f.fields[2]};
+  switch (f.compute_mode) {
+  case ComputeMode::SingleField:
+    fc.compute_field(fc.field1, &s[0]);
+    fc.map_sines(f.freqs.f1, f.freqs.f2, f.freqs.f3);
+    break;
+  case ComputeMode::DualField:
+    if (!fc.compute_fields({fc.field1, fc.field2}, {&s[0], &s[1]}, "map_img2",
+                           image))
+      fc.map_img(image);
+    break;
+  case ComputeMode::TriField:
+    if (!fc.compute_fields({fc.field1, fc.field2, fc.field3},
+                           {&s[0], &s[1], &s[2]},
+                           f.norm ? "pack_norm" : "pack"))
+      fc.fields_to_RGB(f.norm);
+    break;
+  }
+}
+
+bool SessionRecorder::open(string path) {
+  close();
+  out.open(path, ios::binary | ios::trunc);
+  if (!out)
+    return false;
+
+  SessionHeader h;
+  memcpy(h.magic, session_magic, sizeof(h.magic));
+  h.version = session_version;
+  h.frame_size = sizeof(SessionFrame);
+  h.fpn_size = sizeof(FPN);
+  out.write((const char *)&h, sizeof(h));
+  frames = 0;
+  bytes = sizeof(h);
+  return true;
+}
+
+void SessionRecorder::close() {
+  if (out.is_open())
+    out.close();
+}
+
+void SessionRecorder::frame(const SessionFrame &f, const string &func,
+                            const string &image, const string &center) {
+  if (!recording())
+    return;
+
+  if (frames == 0 || func != this->func)
+    write_string(FuncRecord, this->func = func);
+  if (frames == 0 || image != this->image)
+    write_string(ImageRecord, this->image = image);
+  if (frames == 0 || center != this->center)
+    write_string(CenterRecord, this->center = center);
+
+  if (frames > 0 && memcmp((const void *)&f, (const void *)&last,
+                           sizeof(f)) == 0) {
+    write(RepeatRecord, nullptr, 0);
+  } else {
+    write(FrameRecord, &f, sizeof(f));
+    memcpy((void *)&last, (const void *)&f, sizeof(f));
+  }
+  frames++;
+
+  if (!out) // e.g. out of space, stopping rather than logging garbage
+    close();
+}
+
+void SessionRecorder::write(char type, const void *data, size_t size) {
+  out.put(type);
+  out.write((const char *)data, size);
+  bytes += 1 + size;
+}
+
+void SessionRecorder::write_string(char type, const string &s) {
+  uint32_t size = s.size();
+  out.put(type);
+  out.write((const char *)&size, sizeof(size));
+  out.write(s.data(), size);
+  bytes += 1 + sizeof(size) + size;
+}
+
+SessionReader::SessionReader(string path)
+    : in(path, ios::binary), path(path) {
+  SessionHeader h;
+  if (!in.read((char *)&h, sizeof(h)) ||
+      memcmp(h.magic, session_magic, sizeof(h.magic)) != 0)
+    throw runtime_error(path + " is not a session log");
+  if (h.version != session_version)
+    throw runtime_error(path + " is a version " + to_string(h.version) +
+                        " session log, this build reads version " +
+                        to_string(session_version));
+  if (h.frame_size != sizeof(SessionFrame) || h.fpn_size != sizeof(FPN))
+    throw runtime_error(path + " was recorded by another build (FPN of " +
+                        to_string(h.fpn_size) + " bytes?)");
+}
+
+bool SessionReader::next(SessionFrame &f)
+// a record cut short, e.g. by a crash while recording, ends the log
+{
+  int type;
+  while ((type = in.get()) != EOF) {
+    switch (type) {
+    case FuncRecord:
+      func = read_string();
+      break;
+    case ImageRecord:
+      image = read_string();
+      break;
+    case CenterRecord:
+      center = read_string();
+      break;
+    case RepeatRecord:
+      if (frames == 0)
+        throw runtime_error(path + ": repeat before the first frame");
+      f = last;
+      frames++;
+      return true;
+    case FrameRecord:
+      if (!in.read((char *)&last, sizeof(last)))
+        return false;
+      f = last;
+      frames++;
+      return true;
+    default:
+      throw runtime_error(path + ": unknown record type " + to_string(type));
+    }
+    if (!in)
+      return false;
+  }
+  return false;
+}
+
+string SessionReader::read_string() {
+  uint32_t size = 0;
+  in.read((char *)&size, sizeof(size));
+  if (in && size > (1 << 24))
+    throw runtime_error(path + " is corrupt");
+  string s(in ? size : 0, '\0');
+  in.read(s.data(), s.size());
+  return s;
+}
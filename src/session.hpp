@@ -0,0 +1,94 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+
+#include "fractal_compute.hpp"
+
+// format of the logs, to bump whenever SessionFrame or a struct in it
+// (FParam_t, FieldUIState, Freqs, ...) changes, or the records do
+const int session_version = 2;
+
+// Everything the jobs of a GUI frame depend on, but for the strings (recursed
+// function, sample image, deep zoom center) which are recorded as they change.
+// Written as is, so logs are only read back by builds with the same FPN
+struct SessionFrame {
+  FParam_t param; // as update_params left it
+  Complex center;
+  Complex deltas;
+  int backend;
+  int precision;
+  int deep_zoom;
+  int reuse_fields;
+  int progressive;
+  int subdivide;
+  int fuse_fields;
+  int specialize;
+  int multi_device;
+  int cpu_split;
+  int compute_mode;
+  FieldUIState fields[3]; // of the mode, the first one or two if fewer
+  Freqs freqs;            // single field colormap
+  int norm;               // tri field
+  int tone;
+  float tone_clip;
+};
+
+// the FractalCompute part of the frame, the rest zeroed
+SessionFrame session_frame(FractalCompute &fc, int compute_mode);
+// sets fc up for the frame, the strings as read (see SessionReader). The
+// OpenCL backend falls back to the CPU if unavailable
+void apply_frame(FractalCompute &fc, const SessionFrame &f, string func,
+                 string center);
+// queues the frame's jobs, as the GUI does for the mode
+void queue_frame(FractalCompute &fc, const SessionFrame &f, string image);
+
+// deep zoom center at its full precision, for apply_frame
+string center_record(DeepZoom &deep);
+
+class SessionRecorder
+// Appends the state of every frame to a binary log, a repeat marker if
+// nothing changed. For replay (see SessionReader) and saved parameter sets.
+{
+public:
+  int frames = 0;
+  size_t bytes = 0;
+
+  ~SessionRecorder() { close(); }
+
+  // false if path cannot be written
+  bool open(string path);
+  void close();
+  bool recording() { return out.is_open(); }
+  void frame(const SessionFrame &f, const string &func, const string &image,
+             const string &center);
+
+private:
+  ofstream out;
+  SessionFrame last;
+  string func, image, center;
+  void write(char type, const void *data, size_t size);
+  void write_string(char type, const string &s);
+};
+
+class SessionReader
+// Reads back the frames of a SessionRecorder log, throwing runtime_error if
+// it is not one, or was recorded by an incompatible build
+{
+public:
+  // as of the last frame read
+  string func = "";
+  string image = "";
+  string center = "";
+  int frames = 0;
+
+  SessionReader(string path);
+  // false at the end of the log
+  bool next(SessionFrame &f);
+
+private:
+  ifstream in;
+  string path;
+  SessionFrame last;
+  string read_string();
+};